@@ -23,96 +23,194 @@ freely, subject to the following restrictions:
 
 #include <cassert>
 #include <iostream>
+#include <cstring>
 
 #include "misc.h"
 #include "cache.h"
-
-Cache::Cache(unsigned int num_lines, unsigned int assoc) : maxSetSize(assoc)
+#include "waymatch.h"
+
+template <unsigned int Ways, class Policy>
+constexpr uint64_t BasicCache<Ways, Policy>::invalidTag;
+
+constexpr uint32_t RripPolicy::brripPeriod;
+constexpr uint32_t RripPolicy::leaderSets;
+constexpr uint32_t RripPolicy::pselBits;
+constexpr uint32_t RripPolicy::pselPeriod;
+constexpr uint64_t OptPolicy::never;
+constexpr uint64_t OptPolicy::releasePeriod;
+constexpr uint64_t RandomPolicy::multiplier;
+
+template <unsigned int Ways, class Policy>
+BasicCache<Ways, Policy>::BasicCache(unsigned int num_lines, unsigned int assoc,
+               const ReplacementConfig& replacement /*={}*/) : 
+               tags(num_lines, invalidTag),
+               states(num_lines, CacheState::Invalid),
+               policy(num_lines / assoc, assoc, replacement),
+               maxSetSize(assoc)
 {
    assert(num_lines % assoc == 0);
+   assert(assoc <= UINT16_MAX + 1);
+   assert(Ways == 0 || Ways == assoc);
    // The set bits of the address will be used as an index
-   // into sets. Each set is a deque containing "assoc" items
-   sets.resize(num_lines / assoc);
+   // into the arrays, after multiplying by assoc. Nothing is
+   // allocated after this point
+}
+
+// Searches the set with the SIMD way-match kernel, or an unrolled
+// kernel if the associativity is known at compile time
+template <unsigned int Ways, class Policy>
+int BasicCache<Ways, Policy>::matchInSet(uint64_t set, uint64_t tag) const
+{
+   const uint64_t base = set * assoc();
+
+   if (Ways != 0 && Ways <= 64) {
+      return matchWayUnrolled<(Ways <= 64 ? Ways : 0)>(&tags[base], tag);
+   }
+   return matchWay(&tags[base], assoc(), tag);
+}
+
+template <unsigned int Ways, class Policy>
+CacheWay BasicCache<Ways, Policy>::lookup(uint64_t set, uint64_t tag) const
+{
+   int pos = matchInSet(set, tag);
+   return CacheWay{set, pos < 0 ? -1 : (int64_t) (set * assoc() + pos)};
 }
 
 // Given the set and tag, return the cache line's state
 // Invalid and "not found" are equivalent
-CacheState Cache::findTag(uint64_t set, uint64_t tag) const
+template <unsigned int Ways, class Policy>
+CacheState BasicCache<Ways, Policy>::findTag(uint64_t set, uint64_t tag) const
 {
-   for (auto it = sets[set].cbegin(); it != sets[set].cend(); ++it) {
-      if (it->tag == tag) {
-         return it->state;
-      }
+   CacheWay way = lookup(set, tag);
+   if (!way.found()) {
+      return CacheState::Invalid;
    }
 
-   return CacheState::Invalid;
+   return getState(way);
 }
 
 // Changes the cache line specificed by "set" and "tag" to "state"
-// The cache only saves lines that are not Invalid, so delete if that
-// is the new state
-void Cache::changeState(uint64_t set, uint64_t tag, CacheState state)
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::changeState(uint64_t set, uint64_t tag, CacheState state)
 {
-   for (auto it = sets[set].begin(); it != sets[set].end(); ++it) {
-      if (it->tag == tag) {
-         if (state == CacheState::Invalid) {
-            sets[set].erase(it);
-            break;
-         } else {
-            it->state = state;
-            break;
-         }
-      }
+   CacheWay way = lookup(set, tag);
+   if (way.found()) {
+      setState(way, state);
    }
 }
 
-// A complete LRU is mantained for each set, using the ordering
-// of the set deque. The end is considered most
-// recently used. The specified line must be in the cache, it 
-// will be moved to the most-recently used position
-void Cache::updateLRU(uint64_t set, uint64_t tag)
+// The cache only saves lines that are not Invalid, so empty the way
+// if that is the new state
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::setState(const CacheWay& way, CacheState state)
+{
+   states[way.index] = state;
+   if (state == CacheState::Invalid) {
+      tags[way.index] = invalidTag;
+      policy.invalidate(way.set, wayInSet(way), assoc());
+   }
+}
+
+// The specified line must be in the cache. For LRU, it is moved to
+// the most-recently used position
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::updateLRU(uint64_t set, uint64_t tag)
 {
 #ifdef DEBUG
    CacheState foundState = findTag(set, tag);
    assert(foundState != CacheState::Invalid);
 #endif
 
-   CacheLine temp;
-   auto it = sets[set].begin();
-   for(; it != sets[set].end(); ++it) {
-      if(it->tag == tag) {
-         temp = *it;
-         break;
-      }
-   } 
+   touch(lookup(set, tag));
+}
 
-   sets[set].erase(it);
-   sets[set].push_back(temp);
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::touch(const CacheWay& way)
+{
+   policy.touch(way.set, wayInSet(way), assoc());
 }
 
 // Called if a new cache line is to be inserted. Checks if
-// the least recently used line needs to be written back to
+// the line to be replaced needs to be written back to
 // main memory.
-bool Cache::checkWriteback(uint64_t set, uint64_t& tag) const
+template <unsigned int Ways, class Policy>
+bool BasicCache<Ways, Policy>::checkWriteback(uint64_t set, uint64_t& tag) const
 {
-   if (sets[set].size() < maxSetSize) {
-      // There is room in the set, it does not matter the state of the
-      // LRU line
+   CacheWay evict = victim(set);
+   CacheState state = getState(evict);
+   if (state == CacheState::Invalid) {
+      // There is room in the set
       return false;
    }
 
-   const CacheLine& evict = sets[set].front();
-   tag = evict.tag;
-   return (evict.state == CacheState::Modified || evict.state == CacheState::Owned);
+   tag = getTag(evict);
+   return (state == CacheState::Modified || state == CacheState::Owned);
 }
 
-// Insert a new cache line by popping the least recently used line if necessary
-// and pushing the new line to the back (most recently used)
-void Cache::insertLine(uint64_t set, uint64_t tag, CacheState state)
+// Insert a new cache line by replacing the policy's victim, which is
+// empty if the set is not full
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::insertLine(uint64_t set, uint64_t tag, CacheState state)
 {
-   if (sets[set].size() == maxSetSize) {
-      sets[set].pop_front();
+   replace(victim(set), tag, state);
+}
+
+// Empty ways are filled first. Unless the policy already returns them,
+// they are found by searching the set for the empty tag
+template <unsigned int Ways, class Policy>
+CacheWay BasicCache<Ways, Policy>::victim(uint64_t set) const
+{
+   const uint64_t base = set * assoc();
+
+   if (!policy.tracksEmpty()) {
+      int pos = matchInSet(set, invalidTag);
+      if (pos >= 0) {
+         return CacheWay{set, (int64_t) (base + pos)};
+      }
    }
 
-   sets[set].emplace_back(tag, state);
+   return CacheWay{set, (int64_t) (base + policy.victim(set, assoc()))};
 }
+
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::replace(const CacheWay& way, uint64_t tag, CacheState state)
+{
+#ifdef DEBUG
+   assert(way.index == victim(way.set).index);
+#endif
+
+   tags[way.index] = tag;
+   states[way.index] = state;
+   policy.fill(way.set, wayInSet(way), assoc());
+}
+
+template <unsigned int Ways, class Policy>
+void BasicCache<Ways, Policy>::prefetchSet(uint64_t set) const
+{
+   const uint64_t base = set * assoc();
+   const char* set_tags = (const char*) &tags[base];
+
+   for (unsigned int i = 0; i < assoc() * sizeof(uint64_t); i += 64) {
+      __builtin_prefetch(set_tags + i);
+   }
+   __builtin_prefetch(&states[base]);
+   policy.prefetch(set, assoc());
+}
+
+// The runtime versions plus the associativities and policies
+// dispatched to by makeSingleCacheSystem
+template class BasicCache<0, RuntimePolicy>;
+#define INSTANTIATE_CACHES(Policy) \
+   template class BasicCache<0, Policy>; \
+   template class BasicCache<4, Policy>; \
+   template class BasicCache<8, Policy>; \
+   template class BasicCache<16, Policy>; \
+   template class BasicCache<32, Policy>; \
+   template class BasicCache<64, Policy>;
+INSTANTIATE_CACHES(LruPolicy)
+INSTANTIATE_CACHES(TreePlruPolicy)
+INSTANTIATE_CACHES(BitPlruPolicy)
+INSTANTIATE_CACHES(RripPolicy)
+INSTANTIATE_CACHES(OptPolicy)
+INSTANTIATE_CACHES(RandomPolicy)
+INSTANTIATE_CACHES(FifoPolicy)
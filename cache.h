@@ -24,28 +24,83 @@ freely, subject to the following restrictions:
 #pragma once
 
 #include <vector>
-#include <deque>
+#include <cstdint>
 
 #include "misc.h"
+#include "replacement.h"
 
-// Represents a single cache
-class Cache {
+// Handle to a single way of a cache, returned by Cache::lookup and
+// Cache::victim. It remains valid until a line is inserted into or
+// removed from its set
+struct CacheWay {
+   uint64_t set;
+   int64_t index; // Array index of the way, or -1 if the line was not found
+
+   bool found() const { return index >= 0; }
+};
+
+// Represents a single cache. If Ways is not 0 the associativity is
+// fixed at compile time, which lets the compiler unroll the per-set
+// loops. Policy chooses the lines to replace (see replacement.h). Cache
+// is the LRU version with the associativity chosen at runtime, and
+// RuntimeCache the version with the policy chosen at runtime as well
+template <unsigned int Ways = 0, class Policy = LruPolicy>
+class BasicCache {
 public:
    // num_lines is total line capacity, assoc is the number of ways (locations)
-   // a single line can be placed
-   Cache(unsigned int num_lines, unsigned int assoc);
+   // a single line can be placed. replacement configures the policy
+   BasicCache(unsigned int num_lines, unsigned int assoc, 
+              const ReplacementConfig& replacement = {});
    // Returns the state of specified line, or Invalid if not found
    CacheState findTag(uint64_t set, uint64_t tag) const; 
    void changeState(uint64_t set, uint64_t tag, CacheState state);
-   // Line must exist in the cache
+   // Line must exist in the cache. Counts as a hit to the policy
    void updateLRU(uint64_t set, uint64_t tag);
    // Returns true if writeback necessary, and the tag of the line if true
    bool checkWriteback(uint64_t set, uint64_t& tag) const;
-   // Line should not already exist in cache. Will remove the LRU line in set
-   // if there is not enough space, so checkWriteback should be called before this
+   // Line should not already exist in cache. Will remove the policy's
+   // victim from set if there is not enough space, so checkWriteback
+   // should be called before this
    void insertLine(uint64_t set, uint64_t tag, CacheState state);
+
+   // The methods below let a caller search a set once and then act on
+   // the result, rather than searching again in each of the above.
+   // lookup is the only one that searches the set
+   CacheWay lookup(uint64_t set, uint64_t tag) const;
+   // The way must have been found
+   CacheState getState(const CacheWay& way) const { return states[way.index]; }
+   uint64_t getTag(const CacheWay& way) const { return tags[way.index]; }
+   void setState(const CacheWay& way, CacheState state);
+   // Tells the policy a found way was hit
+   void touch(const CacheWay& way);
+   // Returns the way that the next insertion into set will replace.
+   // Its state is Invalid if the set has room
+   CacheWay victim(uint64_t set) const;
+   // Replaces the line in a way returned by victim with a new line
+   void replace(const CacheWay& way, uint64_t tag, CacheState state);
+   // Hints the host to bring the set into its cache ahead of a lookup
+   void prefetchSet(uint64_t set) const;
+   ReplacementStats getReplacementStats() const { return policy.getStats(); }
 private:
-   std::vector<std::deque<CacheLine>> sets;
+   // Tag stored in empty ways. Real tags always have their line offset
+   // bits clear, so this can never match a lookup
+   static constexpr uint64_t invalidTag = ~((uint64_t) 0);
+
+   // All ways of all sets are stored contiguously with a stride of
+   // assoc(), so the ways of set s are [s*assoc(), (s+1)*assoc())
+   // in each of the parallel arrays below
+   std::vector<uint64_t> tags;
+   std::vector<CacheState> states;
+   Policy policy;
    unsigned int maxSetSize;
+
+   unsigned int assoc() const { return Ways ? Ways : maxSetSize; }
+   // Position of tag in set, or -1
+   int matchInSet(uint64_t set, uint64_t tag) const;
+   // Number of a way within its set
+   unsigned int wayInSet(const CacheWay& way) const 
+   { return way.index - way.set * assoc(); }
 };
 
+using Cache = BasicCache<>;
+using RuntimeCache = BasicCache<0, RuntimePolicy>;
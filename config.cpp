@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <sstream>
+#include <cassert>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+
+#include "config.h"
+
+constexpr unsigned int SystemConfig::defaultTids;
+
+// Values out of range are invalid rather than wrapped
+static bool parseUnsigned64(const std::string& value, uint64_t& out)
+{
+   // strtoull would also take a sign and leading spaces
+   if (value.empty() || value.find_first_not_of("0123456789") != std::string::npos) {
+      return false;
+   }
+   char* end;
+   errno = 0;
+   unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+   if (errno == ERANGE || *end != '\0') {
+      return false;
+   }
+   out = parsed;
+   return true;
+}
+
+bool parseUnsigned(const std::string& value, unsigned int& out)
+{
+   uint64_t parsed;
+   if (!parseUnsigned64(value, parsed) || parsed > UINT_MAX) {
+      return false;
+   }
+   out = parsed;
+   return true;
+}
+
+static bool parseBool(const std::string& value, bool& out)
+{
+   if (value == "y") {
+      out = true;
+   } else if (value == "n") {
+      out = false;
+   } else {
+      return false;
+   }
+   return true;
+}
+
+bool setConfigOption(SystemConfig& config, const std::string& key, 
+                     const std::string& value, std::string& error)
+{
+   bool ok;
+   if (key == "system") {
+      ok = true;
+      if (value == "single") {
+         config.type = SystemType::Single;
+      } else if (value == "multi") {
+         config.type = SystemType::Multi;
+      } else if (value == "stack") {
+         config.type = SystemType::Stack;
+      } else {
+         ok = false;
+      }
+   } else if (key == "line_size") {
+      ok = parseUnsigned(value, config.lineSize);
+   } else if (key == "lines") {
+      ok = parseUnsigned(value, config.numLines);
+   } else if (key == "assoc") {
+      ok = parseUnsigned(value, config.assoc);
+   } else if (key == "prefetch") {
+      ok = true;
+      if (value == "none") {
+         config.prefetcher = PrefetcherType::None;
+      } else if (value == "adjacent") {
+         config.prefetcher = PrefetcherType::Adjacent;
+      } else if (value == "sequential") {
+         config.prefetcher = PrefetcherType::Sequential;
+      } else {
+         ok = false;
+      }
+   } else if (key == "domains") {
+      ok = parseUnsigned(value, config.domains) && config.domains > 0;
+   } else if (key == "tid_map") {
+      config.tidToDomain.clear();
+      std::istringstream in(value);
+      std::string domain;
+      ok = !value.empty();
+      while (ok && std::getline(in, domain, value.find(':') != std::string::npos ? ':' : ',')) {
+         unsigned int d;
+         ok = parseUnsigned(domain, d);
+         if (ok) {
+            config.tidToDomain.push_back(d);
+         }
+      }
+   } else if (key == "compulsory") {
+      ok = parseBool(value, config.countCompulsory);
+   } else if (key == "translate") {
+      ok = parseBool(value, config.doAddrTrans);
+   } else if (key == "workers") {
+      ok = parseUnsigned(value, config.workers) && config.workers > 0;
+   } else if (key == "set_sampling") {
+      ok = parseUnsigned(value, config.setSampling) && config.setSampling > 0;
+   } else if (key == "replacement") {
+      ok = true;
+      if (value == "lru") {
+         config.replacement.type = ReplacementType::Lru;
+      } else if (value == "tree_plru") {
+         config.replacement.type = ReplacementType::TreePlru;
+      } else if (value == "bit_plru") {
+         config.replacement.type = ReplacementType::BitPlru;
+      } else if (value == "srrip") {
+         config.replacement.type = ReplacementType::Srrip;
+      } else if (value == "brrip") {
+         config.replacement.type = ReplacementType::Brrip;
+      } else if (value == "drrip") {
+         config.replacement.type = ReplacementType::Drrip;
+      } else if (value == "opt") {
+         config.replacement.type = ReplacementType::Opt;
+      } else if (value == "random") {
+         config.replacement.type = ReplacementType::Random;
+      } else if (value == "fifo") {
+         config.replacement.type = ReplacementType::Fifo;
+      } else {
+         ok = false;
+      }
+   } else if (key == "seed") {
+      ok = parseUnsigned64(value, config.replacement.seed);
+   } else {
+      error = "unknown option " + key;
+      return false;
+   }
+
+   if (!ok) {
+      error = "invalid value '" + value + "' for " + key;
+   }
+   return ok;
+}
+
+bool parseConfig(SystemConfig& config, const std::string& options, 
+                 std::string& error, 
+                 std::set<std::string>* keys /*=nullptr*/)
+{
+   std::istringstream in(options);
+   std::string option;
+   while (std::getline(in, option, ',')) {
+      size_t eq = option.find('=');
+      if (eq == std::string::npos) {
+         error = "expected key=value, not " + option;
+         return false;
+      }
+      if (!setConfigOption(config, option.substr(0, eq), option.substr(eq + 1), 
+                           error)) {
+         return false;
+      }
+      if (keys) {
+         keys->insert(option.substr(0, eq));
+      }
+   }
+   return true;
+}
+
+static bool isPowerOf2(unsigned int x)
+{
+   return x != 0 && (x & (x - 1)) == 0;
+}
+
+bool checkConfig(const SystemConfig& config, std::string& error)
+{
+   if (!isPowerOf2(config.lineSize)) {
+      error = "the line size must be a power of 2";
+   } else if (config.assoc == 0 || config.numLines % config.assoc != 0 ||
+              !isPowerOf2(config.numLines / config.assoc)) {
+      error = "the number of sets (lines / assoc) must be a power of 2";
+   } else if (config.domains == 0) {
+      error = "there must be at least one domain";
+   } else if (config.type != SystemType::Multi && config.domains != 1) {
+      error = "a single cache system has one domain";
+   } else if (config.type == SystemType::Stack && 
+              config.prefetcher != PrefetcherType::None) {
+      error = "a stack distance system has no prefetcher";
+   } else if (config.workers > 1 && config.type == SystemType::Stack) {
+      error = "a stack distance system has one worker";
+   } else if (config.workers > 1 && config.prefetcher != PrefetcherType::None) {
+      error = "a system with several workers has no prefetcher";
+   } else if (!isPowerOf2(config.workers) || 
+              config.workers > config.numLines / config.assoc) {
+      error = "the workers must be a power of 2 no more than the sets";
+   } else if (!isPowerOf2(config.setSampling) || 
+              config.setSampling > config.numLines / config.assoc) {
+      error = "set sampling must be a power of 2 no more than the sets";
+   } else if (config.setSampling > 1 && 
+              (config.workers > 1 || config.type == SystemType::Stack)) {
+      error = "set sampling needs a single or multi system with one worker";
+   } else if (config.type == SystemType::Stack && 
+              config.replacement.type != ReplacementType::Lru) {
+      error = "a stack distance system is LRU";
+   } else if (config.replacement.type == ReplacementType::Drrip &&
+              config.numLines / config.assoc / config.setSampling < 4) {
+      error = "DRRIP needs at least 4 sets (after set sampling) for its "
+              "leader and follower sets";
+   } else if (config.workers > 1 && !isPerSet(config.replacement.type)) {
+      error = "the replacement policy has state shared by every set, so it "
+              "needs one worker";
+   } else if (config.replacement.type == ReplacementType::TreePlru &&
+              (!isPowerOf2(config.assoc) || config.assoc > 64)) {
+      error = "tree PLRU needs a power of 2 associativity up to 64";
+   } else if (config.replacement.type == ReplacementType::BitPlru &&
+              config.assoc > 64) {
+      error = "bit PLRU needs an associativity up to 64";
+   } else if (config.replacement.type == ReplacementType::Opt &&
+              (config.type != SystemType::Single || config.workers > 1 ||
+               config.setSampling > 1 || 
+               config.prefetcher != PrefetcherType::None)) {
+      error = "OPT needs a single system with one worker, no set sampling "
+              "and no prefetcher";
+   } else {
+      for (unsigned int domain : config.tidToDomain) {
+         if (domain >= config.domains) {
+            error = "the TID map has a domain beyond the number of domains";
+            return false;
+         }
+      }
+      return true;
+   }
+   return false;
+}
+
+std::string configString(const SystemConfig& config)
+{
+   static const char* types[] = {"single", "multi", "stack"};
+   static const char* prefetchers[] = {"none", "adjacent", "sequential"};
+   static const char* replacements[] = {"lru", "tree_plru", "bit_plru", 
+                                        "srrip", "brrip", "drrip", "opt", 
+                                        "random", "fifo"};
+   std::ostringstream out;
+   out << "system=" << types[(int) config.type]
+       << ",line_size=" << config.lineSize
+       << ",lines=" << config.numLines
+       << ",assoc=" << config.assoc
+       << ",prefetch=" << prefetchers[(int) config.prefetcher]
+       << ",domains=" << config.domains;
+   if (!config.tidToDomain.empty()) {
+      out << ",tid_map=";
+      for (size_t i = 0; i < config.tidToDomain.size(); ++i) {
+         out << (i ? ":" : "") << config.tidToDomain[i];
+      }
+   }
+   out << ",compulsory=" << (config.countCompulsory ? "y" : "n")
+       << ",translate=" << (config.doAddrTrans ? "y" : "n")
+       << ",workers=" << config.workers
+       << ",set_sampling=" << config.setSampling
+       << ",replacement=" << replacements[(int) config.replacement.type];
+   if (config.replacement.type == ReplacementType::Random) {
+      out << ",seed=" << config.replacement.seed;
+   }
+   return out.str();
+}
+
+std::unique_ptr<ConfiguredSystem> makeSystem(const SystemConfig& config)
+{
+   auto configured = std::make_unique<ConfiguredSystem>();
+   configured->config = config;
+   std::vector<unsigned int>& tid_map = configured->config.tidToDomain;
+   if (tid_map.empty()) {
+      for (unsigned int i = 0; i < SystemConfig::defaultTids; ++i) {
+         tid_map.push_back(i % config.domains);
+      }
+   }
+
+   std::unique_ptr<Prefetch> prefetch;
+   if (config.prefetcher == PrefetcherType::Adjacent) {
+      prefetch = std::make_unique<AdjPrefetch>();
+   } else if (config.prefetcher == PrefetcherType::Sequential) {
+      prefetch = std::make_unique<SeqPrefetch>();
+   }
+
+   // Set by the caller, from a first pass over the trace
+   assert(config.replacement.type != ReplacementType::Opt ||
+          (config.replacement.nextUse && 
+           config.replacement.nextUse->getLineSize() == config.lineSize));
+
+   if (config.type == SystemType::Stack) {
+      configured->sys = std::make_unique<StackDistanceSystem>(config.lineSize,
+                  config.numLines / config.assoc, config.assoc, 
+                  config.countCompulsory, config.doAddrTrans);
+   } else if (config.type == SystemType::Single && config.workers > 1) {
+      configured->sys = std::make_unique<ParallelSingleCacheSystem>(
+                  config.lineSize, config.numLines, config.assoc, 
+                  config.workers, config.countCompulsory, config.doAddrTrans,
+                  config.replacement);
+   } else if (config.type == SystemType::Single) {
+      configured->sys = makeSingleCacheSystem(config.lineSize, config.numLines,
+                  config.assoc, std::move(prefetch), config.countCompulsory, 
+                  config.doAddrTrans, config.setSampling, config.replacement);
+   } else if (config.workers > 1) {
+      configured->sys = std::make_unique<ParallelMultiCacheSystem>(tid_map, 
+                  config.lineSize, config.numLines, config.assoc, 
+                  config.workers, config.countCompulsory, config.doAddrTrans, 
+                  config.domains, config.replacement);
+   } else {
+      configured->sys = makeMultiCacheSystem(tid_map, config.lineSize, 
+                  config.numLines, config.assoc, std::move(prefetch), 
+                  config.countCompulsory, config.doAddrTrans, config.domains,
+                  config.setSampling, config.replacement);
+   }
+
+   return configured;
+}
@@ -0,0 +1,107 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <set>
+
+#include "system.h"
+#include "parallel.h"
+
+enum class SystemType {
+   Single, 
+   Multi, 
+   // A StackDistanceSystem, giving the misses of every associativity up
+   // to assoc with lines / assoc sets
+   Stack,
+};
+enum class PrefetcherType {None, Adjacent, Sequential};
+
+// Everything needed to create a System, so drivers can choose the
+// simulated system at run time
+struct SystemConfig {
+   SystemType type{SystemType::Multi};
+   unsigned int lineSize{64};
+   unsigned int numLines{1024};
+   unsigned int assoc{64};
+   PrefetcherType prefetcher{PrefetcherType::Sequential};
+   unsigned int domains{2};
+   // NUMA/cache domain of each TID. If empty, TID t is in domain
+   // t % domains for the first defaultTids TIDs
+   std::vector<unsigned int> tidToDomain;
+   bool countCompulsory{false};
+   bool doAddrTrans{false};
+   // Threads simulating the system, see parallel.h
+   unsigned int workers{1};
+   // Only 1 in setSampling sets are simulated, see System
+   unsigned int setSampling{1};
+   ReplacementConfig replacement;
+
+   static constexpr unsigned int defaultTids = 256;
+};
+
+// Sets the option key of config to value. The keys are:
+//    system      single|multi|stack
+//    line_size   cache line size in bytes
+//    lines       number of cache lines per cache
+//    assoc       associativity
+//    prefetch    none|adjacent|sequential
+//    domains     number of caches/NUMA domains
+//    tid_map     domain of each TID, separated by ':' or ','
+//    compulsory  y|n, count compulsory misses
+//    translate   y|n, do virtual to physical translation
+//    workers     threads dividing the sets between them
+//    set_sampling  simulate only 1 in this many sets
+//    replacement lru|tree_plru|bit_plru|srrip|brrip|drrip|opt|random|fifo
+//    seed        seed of random replacement
+// Returns false and sets error if the key or value is invalid
+bool setConfigOption(SystemConfig& config, const std::string& key, 
+                     const std::string& value, std::string& error);
+// Sets the options of a list of key=value pairs separated by ',', and
+// adds their keys to keys if it is not null
+bool parseConfig(SystemConfig& config, const std::string& options, 
+                 std::string& error, std::set<std::string>* keys = nullptr);
+// Returns false and sets error if the options are inconsistent
+bool checkConfig(const SystemConfig& config, std::string& error);
+// The config as a list that parseConfig accepts
+std::string configString(const SystemConfig& config);
+// Parses a decimal number, without a sign or spaces, into out. Returns
+// false if value is not one or does not fit
+bool parseUnsigned(const std::string& value, unsigned int& out);
+
+// A System created from a config, which also owns the TID map the
+// System refers to
+struct ConfiguredSystem {
+   SystemConfig config;
+   std::unique_ptr<System> sys;
+};
+
+// Creates the System of a config that checkConfig accepts, using the
+// factories in system.h so the implementation is specialized for its
+// geometry and prefetcher where possible. An OPT config's
+// replacement.nextUse must be set to the index of the trace for its
+// line size
+std::unique_ptr<ConfiguredSystem> makeSystem(const SystemConfig& config);
@@ -0,0 +1,205 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <cassert>
+#include <cstring>
+#include <vector>
+
+#include "lz.h"
+
+static const unsigned int hashBits = 14;
+static const size_t maxOffset = 65535;
+
+static inline uint32_t load32(const uint8_t* p)
+{
+   uint32_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline uint64_t load64(const uint8_t* p)
+{
+   uint64_t v;
+   std::memcpy(&v, p, sizeof(v));
+   return v;
+}
+
+static inline uint32_t hash(uint32_t v)
+{
+   return (v * 2654435761U) >> (32 - hashBits);
+}
+
+// Writes the part of a length beyond a token nibble
+static inline uint8_t* writeLength(uint8_t* op, size_t len)
+{
+   for (; len >= 255; len -= 255) {
+      *op++ = 255;
+   }
+   *op++ = (uint8_t) len;
+   return op;
+}
+
+static inline size_t readLength(const uint8_t*& ip, const uint8_t* end)
+{
+   size_t len = 0;
+   uint8_t b;
+   do {
+      assert(ip < end);
+      b = *ip++;
+      len += b;
+   } while (b == 255);
+   (void) end;
+   return len;
+}
+
+static uint8_t* writeSequence(uint8_t* op, const uint8_t* literals, 
+                     size_t lit_len, size_t offset, size_t match_len)
+{
+   uint8_t* token = op++;
+   *token = (uint8_t) ((lit_len < 15 ? lit_len : 15) << 4);
+   if (lit_len >= 15) {
+      op = writeLength(op, lit_len - 15);
+   }
+   std::memcpy(op, literals, lit_len);
+   op += lit_len;
+
+   if (match_len > 0) {
+      size_t len = match_len - lzMinMatch;
+      *token |= (uint8_t) (len < 15 ? len : 15);
+      *op++ = (uint8_t) offset;
+      *op++ = (uint8_t) (offset >> 8);
+      if (len >= 15) {
+         op = writeLength(op, len - 15);
+      }
+   }
+
+   return op;
+}
+
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst)
+{
+   // Positions of recent 4-byte sequences by their hash. Candidates
+   // are checked against the input, so stale entries are harmless
+   std::vector<uint32_t> table(1 << hashBits, 0);
+   uint8_t* op = dst;
+   size_t anchor = 0; // Start of the pending literals
+   size_t i = 0;
+
+   // Matches are only searched and extended where 8 bytes can be read
+   const size_t limit = size >= 8 ? size - 8 : 0;
+   while (i < limit) {
+      uint32_t seq = load32(src + i);
+      uint32_t& entry = table[hash(seq)];
+      size_t cand = entry;
+      entry = (uint32_t) i;
+
+      if (cand >= i || i - cand > maxOffset || load32(src + cand) != seq) {
+         // Step faster through data that doesn't compress
+         i += 1 + ((i - anchor) >> 6);
+         continue;
+      }
+
+      size_t len = lzMinMatch;
+      while (i + len < limit) {
+         uint64_t diff = load64(src + cand + len) ^ load64(src + i + len);
+         if (diff) {
+            len += __builtin_ctzll(diff) / 8;
+            break;
+         }
+         len += 8;
+      }
+
+      op = writeSequence(op, src + anchor, i - anchor, i - cand, len);
+      i += len;
+      anchor = i;
+      if (i < limit) {
+         table[hash(load32(src + i - 2))] = (uint32_t) (i - 2);
+      }
+   }
+
+   op = writeSequence(op, src + anchor, size - anchor, 0, 0);
+   return op - dst;
+}
+
+void lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, 
+                  size_t raw_size)
+{
+   const uint8_t* ip = src;
+   const uint8_t* const ip_end = src + size;
+   uint8_t* op = dst;
+   uint8_t* const op_end = dst + raw_size;
+
+   while (true) {
+      assert(ip < ip_end);
+      uint8_t token = *ip++;
+
+      size_t lit_len = token >> 4;
+      if (lit_len == 15) {
+         lit_len += readLength(ip, ip_end);
+      }
+      assert(lit_len <= (size_t) (ip_end - ip) && 
+             lit_len <= (size_t) (op_end - op));
+      if (lit_len <= 16 && ip_end - ip >= 16) {
+         // Short runs are copied with a fixed size, which is faster
+         // than calling memcpy
+         std::memcpy(op, ip, 16);
+      } else {
+         std::memcpy(op, ip, lit_len);
+      }
+      ip += lit_len;
+      op += lit_len;
+
+      if (op == op_end) {
+         break;
+      }
+
+      assert(ip + 2 <= ip_end);
+      size_t offset = ip[0] | (ip[1] << 8);
+      ip += 2;
+      size_t len = token & 0xF;
+      if (len == 15) {
+         len += readLength(ip, ip_end);
+      }
+      len += lzMinMatch;
+      assert(offset > 0 && offset <= (size_t) (op - dst) && 
+             len <= (size_t) (op_end - op));
+
+      const uint8_t* match = op - offset;
+      if (offset >= 16 && len <= 16) {
+         std::memcpy(op, match, 16);
+      } else if (offset >= 8) {
+         // Copies in 8 byte steps, each from bytes already written,
+         // and may write up to 7 bytes past the match
+         for (size_t j = 0; j < len; j += 8) {
+            std::memcpy(op + j, match + j, 8);
+         }
+      } else {
+         for (size_t j = 0; j < len; ++j) {
+            op[j] = match[j];
+         }
+      }
+      op += len;
+   }
+
+   assert(ip == ip_end);
+}
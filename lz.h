@@ -0,0 +1,53 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// A small LZ77 block compressor in the style of LZ4, used for
+// compressed traces. Each call compresses one self-contained block.
+//
+// A block is a series of sequences, each a token byte followed by
+// literals and a match. The token's high nibble is the literal count
+// and its low nibble the match length minus lzMinMatch; a nibble of 15
+// is followed by bytes adding to it, 255 at a time until one is less
+// than 255. The literals follow the token (and literal count bytes),
+// then a 2-byte little-endian offset back to the match and its length
+// bytes. The last sequence has only literals.
+
+constexpr size_t lzMinMatch = 4;
+// Bytes that lzDecompress may write past the end of its output
+constexpr size_t lzSlack = 16;
+
+// Upper bound of the compressed size of size bytes
+inline size_t lzBound(size_t size) { return size + size / 255 + 16; }
+
+// Compresses size bytes from src into dst, which must hold
+// lzBound(size) bytes. Returns the compressed size
+size_t lzCompress(const uint8_t* src, size_t size, uint8_t* dst);
+// Decompresses a block of size bytes from src, which must decompress to
+// exactly raw_size bytes, into dst. dst must hold raw_size + lzSlack bytes
+void lzDecompress(const uint8_t* src, size_t size, uint8_t* dst, 
+                  size_t raw_size);
@@ -22,76 +22,517 @@ freely, subject to the following restrictions:
 */
 
 #include <iostream>
-#include <fstream>
-#include <cassert>
-#include <sstream>
 #include <string>
+#include <cstdlib>
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <map>
+#include <set>
+#include <getopt.h>
+#include <sys/stat.h>
 
-#include "system.h"
+#include "config.h"
+#include "trace.h"
+#include "pipeline.h"
+#include "sample.h"
+#include "nextuse.h"
 
 using namespace std;
 
-int main()
+// Reads the config lists of a sweep file, one per line. Blank lines
+// and lines starting with '#' are skipped
+bool readSweepFile(const string& path, vector<string>& lists)
+{
+   ifstream in(path);
+   string line;
+   while (getline(in, line)) {
+      line.erase(0, line.find_first_not_of(" \t"));
+      line.erase(line.find_last_not_of(" \t\r") + 1);
+      if (!line.empty() && line[0] != '#') {
+         lists.push_back(line);
+      }
+   }
+   return in.eof();
+}
+
+// Parses the sampling periods of --sample, as INTERVAL:WARMUP:DETAIL
+bool parseSampling(const string& value, uint64_t& interval, uint64_t& warmup,
+                   uint64_t& detail)
+{
+   char end;
+   unsigned long long i, w, d;
+   if (sscanf(value.c_str(), "%llu:%llu:%llu%c", &i, &w, &d, &end) != 3) {
+      return false;
+   }
+   interval = i;
+   warmup = w;
+   detail = d;
+   // Written so the sum can't overflow
+   return detail > 0 && detail <= interval && warmup <= interval - detail;
+}
+
+// OPT replacement needs the next use of every access before the first
+// is simulated, so the trace is read through once first to build a
+// NextUseIndex for each line size of the OPT configs, kept in index_dir
+// (see makeNextUseIndex). Returns false and sets error if the trace is
+// not a file that can be read again or an index can't be created or
+// grown
+bool buildNextUseIndexes(const string& trace_path, TraceFormat format,
+                         const string& index_dir, 
+                         vector<SystemConfig>& configs, string& error)
+{
+   map<unsigned int, shared_ptr<NextUseIndex>> indexes;
+   for (const SystemConfig& c : configs) {
+      if (c.replacement.type == ReplacementType::Opt && 
+          !indexes.count(c.lineSize)) {
+         indexes[c.lineSize] = makeNextUseIndex(c.lineSize, index_dir, error);
+         if (!indexes[c.lineSize]) {
+            return false;
+         }
+      }
+   }
+   if (indexes.empty()) {
+      return true;
+   }
+
+   struct stat st;
+   if (trace_path == "-" || 
+       (stat(trace_path.c_str(), &st) == 0 && !S_ISREG(st.st_mode))) {
+      error = "OPT replacement needs a trace file, not a pipe";
+      return false;
+   }
+   unique_ptr<TraceReader> reader = openTrace(trace_path, format, error);
+   if (!reader) {
+      return false;
+   }
+   if (auto mapped = dynamic_cast<MappedTraceReader*>(reader.get())) {
+      // Read straight from the mapping, as in main
+      TraceSpan span;
+      while (mapped->next(span)) {
+         for (size_t i = 0; i < span.size; ++i) {
+            uint64_t address = span[i].address;
+            for (auto& index : indexes) {
+               if (!index.second->add(address, error)) {
+                  return false;
+               }
+            }
+         }
+      }
+   } else {
+      TracePipeline pipeline([&](TraceBlock& block) { 
+         return reader->next(block); 
+      });
+      while (const TraceBlock* block = pipeline.next()) {
+         for (auto& index : indexes) {
+            if (!index.second->add(block->addrs.data(), block->size, error)) {
+               return false;
+            }
+         }
+      }
+   }
+
+   for (auto& index : indexes) {
+      index.second->finish();
+   }
+   for (SystemConfig& c : configs) {
+      if (c.replacement.type == ReplacementType::Opt) {
+         c.replacement.nextUse = indexes[c.lineSize];
+      }
+   }
+   return true;
+}
+
+void printStats(const SystemStats& stats, uint64_t accesses, bool compulsory)
 {
-   // tid_map is used to inform the simulator how
-   // thread ids map to NUMA/cache domains. Using
-   // the tid as an index gives the NUMA domain.
-   unsigned int arr_map[] = {0, 1};
-   vector<unsigned int> tid_map(arr_map, arr_map + 
-         sizeof(arr_map) / sizeof(unsigned int));
-   std::unique_ptr<SeqPrefetch> prefetch = std::make_unique<SeqPrefetch>();
-   // The constructor parameters are:
-   // the tid_map, the cache line size in bytes,
-   // number of cache lines, the associativity,
-   // the prefetcher object,
-   // whether to count compulsory misses,
-   // whether to do virtual to physical translation,
-   // and number of caches/domains
-   // WARNING: counting compulsory misses doubles execution time
-   MultiCacheSystem sys(tid_map, 64, 1024, 64, std::move(prefetch), false, false, 2);
-   char rw;
-   uint64_t address;
-   unsigned long long lines = 0;
-   ifstream infile;
+   cout << "Accesses: " << accesses << endl;
+   cout << "Hits: " << stats.hits << endl;
+   cout << "Misses: " << accesses - stats.hits << endl;
+   cout << "Local reads: " << stats.local_reads << endl;
+   cout << "Local writes: " << stats.local_writes << endl;
+   cout << "Remote reads: " << stats.remote_reads << endl;
+   cout << "Remote writes: " << stats.remote_writes << endl;
+   cout << "Other-cache reads: " << stats.othercache_reads << endl;
+   if (compulsory) {
+      cout << "Compulsory Misses: " << stats.compulsory << endl;
+   }
+
+   const ReplacementStats& replacement = stats.replacement;
+   if (std::any_of(begin(replacement.rrpvInserts), end(replacement.rrpvInserts),
+                   [](uint64_t n) { return n > 0; })) {
+      cout << "Inserts by RRPV:";
+      for (uint64_t n : replacement.rrpvInserts) {
+         cout << " " << n;
+      }
+      cout << endl;
+   }
+   for (size_t c = 0; c < replacement.psel.size(); ++c) {
+      if (replacement.psel[c].empty()) {
+         continue;
+      }
+      cout << "PSEL";
+      if (replacement.psel.size() > 1) {
+         cout << " of cache " << c;
+      }
+      cout << " every " << RripPolicy::pselPeriod << " fills:";
+      for (uint16_t psel : replacement.psel[c]) {
+         cout << " " << psel;
+      }
+      cout << endl;
+   }
+}
+
+void printEstimate(const SampleEstimate& hit_rate, uint64_t accesses)
+{
+   cout << "Hit rate: " << hit_rate.mean << " +- " << hit_rate.halfWidth 
+        << " (95% confidence)" << endl;
+   cout << "Estimated hits: " << (uint64_t) (hit_rate.mean * accesses) 
+        << " +- " << hit_rate.halfWidth * accesses << endl;
+}
+
+void usage() {
+   SystemConfig defaults;
+   cout << "Usage: ./cache [options] [trace file, default pinatrace.out, '-' for stdin]\n"
+        << "   -s, --system single|multi|stack  system type (multi), stack\n"
+        << "                                gives the misses of every associativity\n"
+        << "                                up to --assoc with the same sets\n"
+        << "   -l, --line-size BYTES        cache line size (" << defaults.lineSize << ")\n"
+        << "   -n, --lines N                cache lines per cache (" << defaults.numLines << ")\n"
+        << "   -a, --assoc N                associativity (" << defaults.assoc << ")\n"
+        << "   -p, --prefetch none|adjacent|sequential  prefetcher (sequential)\n"
+        << "   -d, --domains N              caches/NUMA domains (" << defaults.domains << ")\n"
+        << "   -m, --tid-map D0,D1,...      domain of each TID (TID % domains)\n"
+        << "   -c, --compulsory             count compulsory misses\n"
+        << "   -t, --translate              do virtual to physical translation\n"
+        << "   -w, --workers N              threads dividing the sets between\n"
+        << "                                them, without prefetching (1)\n"
+        << "   -k, --set-sampling K         simulate 1 in K sets and extrapolate\n"
+        << "   -r, --replacement POLICY     lru|tree_plru|bit_plru|srrip|brrip|drrip|\n"
+        << "                                opt|random|fifo, replacement policy\n"
+        << "                                (lru). opt reads the trace file twice\n"
+        << "   -I, --index-dir DIR          directory of opt's next-use index, 4\n"
+        << "                                bytes per access ($TMPDIR or /tmp,\n"
+        << "                                which may be a tmpfs in memory)\n"
+        << "   -R, --seed N                 seed of random replacement (" 
+        << defaults.replacement.seed << ")\n"
+        << "   -P, --sample I:W:D           simulate the last W + D accesses of\n"
+        << "                                every I, measuring the last D\n"
+        << "   -f, --format auto|text|binary  trace format (auto)\n"
+        << "   -T, --fake-tids N            TIDs to make up for traces without\n"
+        << "                                them, assigned round robin (2)\n"
+        << "   -C, --config KEY=VALUE,...   simulate a system with these options\n"
+        << "                                changed (see config.h), may be repeated\n"
+        << "   -S, --sweep FILE             as --config for each line of FILE\n"
+        << "   -j, --jobs N                 threads simulating the systems of a\n"
+        << "                                sweep (one per CPU)\n"
+        << "   -h, --help                   show this message" << endl;
+}
+
+int main(int argc, char* argv[])
+{
+   // The defaults are those of the original example driver: two
+   // 64KB caches with 64 byte lines and sequential prefetching, with
+   // TIDs 0 and 1 in domains 0 and 1
+   SystemConfig config;
+   TraceFormat format = TraceFormat::Auto;
+   unsigned int fake_tids = 2;
+   bool domains_set = false;
+   bool prefetch_set = false;
+   // Options of each system of a sweep
+   vector<string> config_lists;
+   unsigned int jobs = 0;
+   // Sampling periods, or 0 to simulate the whole trace
+   uint64_t sample_interval = 0;
+   uint64_t sample_warmup = 0;
+   uint64_t sample_detail = 0;
+   // Directory of the OPT next-use indexes, $TMPDIR or /tmp if empty
+   string index_dir;
+   string error;
+
+   static const struct option long_options[] = {
+      {"system", required_argument, nullptr, 's'},
+      {"line-size", required_argument, nullptr, 'l'},
+      {"lines", required_argument, nullptr, 'n'},
+      {"assoc", required_argument, nullptr, 'a'},
+      {"prefetch", required_argument, nullptr, 'p'},
+      {"domains", required_argument, nullptr, 'd'},
+      {"tid-map", required_argument, nullptr, 'm'},
+      {"compulsory", no_argument, nullptr, 'c'},
+      {"translate", no_argument, nullptr, 't'},
+      {"workers", required_argument, nullptr, 'w'},
+      {"set-sampling", required_argument, nullptr, 'k'},
+      {"replacement", required_argument, nullptr, 'r'},
+      {"seed", required_argument, nullptr, 'R'},
+      {"index-dir", required_argument, nullptr, 'I'},
+      {"sample", required_argument, nullptr, 'P'},
+      {"format", required_argument, nullptr, 'f'},
+      {"fake-tids", required_argument, nullptr, 'T'},
+      {"config", required_argument, nullptr, 'C'},
+      {"sweep", required_argument, nullptr, 'S'},
+      {"jobs", required_argument, nullptr, 'j'},
+      {"help", no_argument, nullptr, 'h'},
+      {nullptr, 0, nullptr, 0}
+   };
+
+   int opt;
+   while ((opt = getopt_long(argc, argv, "s:l:n:a:p:d:m:ctw:k:r:R:I:P:f:T:C:S:j:h", long_options, 
+                             nullptr)) != -1) {
+      bool ok = true;
+      switch (opt) {
+         case 's': ok = setConfigOption(config, "system", optarg, error); break;
+         case 'l': ok = setConfigOption(config, "line_size", optarg, error); break;
+         case 'n': ok = setConfigOption(config, "lines", optarg, error); break;
+         case 'a': ok = setConfigOption(config, "assoc", optarg, error); break;
+         case 'p': 
+            ok = setConfigOption(config, "prefetch", optarg, error); 
+            prefetch_set = true;
+            break;
+         case 'd': 
+            ok = setConfigOption(config, "domains", optarg, error); 
+            domains_set = true;
+            break;
+         case 'm': ok = setConfigOption(config, "tid_map", optarg, error); break;
+         case 'c': config.countCompulsory = true; break;
+         case 't': config.doAddrTrans = true; break;
+         case 'w': ok = setConfigOption(config, "workers", optarg, error); break;
+         case 'k': 
+            ok = setConfigOption(config, "set_sampling", optarg, error); 
+            break;
+         case 'r': 
+            ok = setConfigOption(config, "replacement", optarg, error); 
+            break;
+         case 'R': ok = setConfigOption(config, "seed", optarg, error); break;
+         case 'I': index_dir = optarg; break;
+         case 'P':
+            ok = parseSampling(optarg, sample_interval, sample_warmup, 
+                               sample_detail);
+            error = "invalid sampling periods " + string(optarg);
+            break;
+         case 'f':
+            if (string(optarg) == "auto") {
+               format = TraceFormat::Auto;
+            } else if (string(optarg) == "text") {
+               format = TraceFormat::Text;
+            } else if (string(optarg) == "binary") {
+               format = TraceFormat::Binary;
+            } else {
+               ok = false;
+               error = "invalid trace format " + string(optarg);
+            }
+            break;
+         case 'T':
+            ok = parseUnsigned(optarg, fake_tids) && fake_tids > 0;
+            error = "invalid value '" + string(optarg) + "' for fake_tids";
+            break;
+         case 'C':
+            config_lists.push_back(optarg);
+            break;
+         case 'S':
+            ok = readSweepFile(optarg, config_lists);
+            error = "cannot read sweep file " + string(optarg);
+            break;
+         case 'j':
+            ok = parseUnsigned(optarg, jobs) && jobs > 0;
+            error = "invalid value '" + string(optarg) + "' for jobs";
+            break;
+         case 'h':
+            usage();
+            return 0;
+         default:
+            usage();
+            return -1;
+      }
+
+      if (!ok) {
+         cerr << error << endl;
+         return -1;
+      }
+   }
+
+   if (optind + 1 < argc) {
+      cerr << "too many arguments" << endl;
+      usage();
+      return -1;
+   }
+
+   // Each config list of a sweep changes the options given above
+   vector<SystemConfig> configs;
+   if (config_lists.empty()) {
+      config_lists.push_back("");
+   }
+   for (const string& list : config_lists) {
+      SystemConfig sweep_config = config;
+      set<string> keys;
+      if (!parseConfig(sweep_config, list, error, &keys)) {
+         cerr << error << " in '" << list << "'" << endl;
+         return -1;
+      }
+      // A single cache has one domain unless told otherwise. Stack
+      // distances, parallel systems and OPT are simulated without
+      // prefetching
+      if (!domains_set && !keys.count("domains") && 
+          sweep_config.type != SystemType::Multi) {
+         sweep_config.domains = 1;
+      }
+      if ((sweep_config.type == SystemType::Stack || sweep_config.workers > 1 ||
+           sweep_config.replacement.type == ReplacementType::Opt) &&
+          !prefetch_set && !keys.count("prefetch")) {
+         sweep_config.prefetcher = PrefetcherType::None;
+      }
+      if (!checkConfig(sweep_config, error)) {
+         cerr << error << (list.empty() ? "" : " in '" + list + "'") << endl;
+         return -1;
+      }
+      if (sample_interval && (sweep_config.type == SystemType::Stack || 
+                              sweep_config.setSampling > 1 ||
+                              sweep_config.replacement.type == 
+                                 ReplacementType::Opt)) {
+         cerr << "only single and multi systems without set sampling or OPT "
+              << "can be sampled in time" << endl;
+         return -1;
+      }
+      configs.push_back(sweep_config);
+   }
+
    // This code works with the output from the 
-   // ManualExamples/pinatrace pin tool
-   infile.open("pinatrace.out", ifstream::in);
-   assert(infile.is_open());
-
-   while(!infile.eof())
-   {
-      infile.ignore(256, ':');
-
-      infile >> rw;
-      assert(rw == 'R' || rw == 'W');
-      AccessType accessType;
-      if (rw == 'R') {
-         accessType = AccessType::Read;
-      } else {
-         accessType = AccessType::Write;
-      }
-
-      infile >> hex >> address;
-      if(address != 0) {
-         // By default the pinatrace tool doesn't record the tid,
-         // so we make up a tid to stress the MultiCache functionality
-         sys.memAccess(address, accessType, lines%2);
-      }
-
-      ++lines;
-   }
-
-   cout << "Accesses: " << lines << endl;
-   cout << "Hits: " << sys.stats.hits << endl;
-   cout << "Misses: " << lines - sys.stats.hits << endl;
-   cout << "Local reads: " << sys.stats.local_reads << endl;
-   cout << "Local writes: " << sys.stats.local_writes << endl;
-   cout << "Remote reads: " << sys.stats.remote_reads << endl;
-   cout << "Remote writes: " << sys.stats.remote_writes << endl;
-   cout << "Other-cache reads: " << sys.stats.othercache_reads << endl;
-   //cout << "Compulsory Misses: " << sys.stats.compulsory << endl;
-   
-   infile.close();
+   // ManualExamples/pinatrace pin tool, or a binary trace
+   // converted from it with trace_convert. The trace can also be
+   // read from stdin ("-") or a named pipe
+   string trace_path = optind < argc ? argv[optind] : "pinatrace.out";
+   if (!buildNextUseIndexes(trace_path, format, index_dir, configs, error)) {
+      cerr << error << endl;
+      return -1;
+   }
+
+   // makeSystem picks the implementation specialized for the geometry
+   // and prefetcher, see system.h
+   vector<unique_ptr<ConfiguredSystem>> systems;
+   vector<System*> sweep;
+   for (const SystemConfig& system_config : configs) {
+      systems.push_back(makeSystem(system_config));
+      unique_ptr<System>& sys = systems.back()->sys;
+      if (sample_interval) {
+         sys = make_unique<SampledSystem>(move(sys), sample_interval, 
+                                          sample_warmup, sample_detail);
+      }
+      sweep.push_back(sys.get());
+   }
+
+   uint64_t lines = 0;
+   // By default the pinatrace tool doesn't record the tid, so for
+   // traces without tids we make one up to stress the MultiCache
+   // functionality
+   unique_ptr<TraceReader> reader = openTrace(trace_path, format, error);
+   if (!reader) {
+      cerr << error << endl;
+      return -1;
+   }
+   bool has_tid = reader->hasTids();
+   // Only a MultiCacheSystem looks TIDs up in its map
+   bool check_tids = false;
+   size_t num_tids = ~((size_t) 0);
+   for (const unique_ptr<ConfiguredSystem>& configured : systems) {
+      if (configured->config.type == SystemType::Multi) {
+         check_tids = true;
+         num_tids = min(num_tids, configured->config.tidToDomain.size());
+      }
+   }
+   if (check_tids && !has_tid && fake_tids > num_tids) {
+      cerr << "the TID map has fewer than " << fake_tids << " TIDs" << endl;
+      return -1;
+   }
+
+   // Checks a TID read from the trace
+   auto check_tid = [&](unsigned int tid) {
+      if (tid >= num_tids) {
+         cerr << "TID " << tid << " is not in the TID map" << endl;
+         exit(-1);
+      }
+   };
+
+   uint64_t records_read = 0;
+   auto read_block = [&](TraceBlock& block) {
+      bool more = reader->next(block);
+      if (!has_tid) {
+         for (size_t i = 0; i < block.size; ++i) {
+            block.tids[i] = (records_read + i) % fake_tids;
+         }
+      } else if (check_tids) {
+         for (size_t i = 0; i < block.size; ++i) {
+            check_tid(block.tids[i]);
+         }
+      }
+      records_read += block.size;
+      return more;
+   };
+
+   auto mapped = dynamic_cast<MappedTraceReader*>(reader.get());
+   if (sweep.size() == 1 && mapped) {
+      // Uncompressed binary traces need no decoding, so their records
+      // are simulated in place in the mapping
+      TraceSpan span;
+      while (mapped->next(span)) {
+         for (size_t i = 0; i < span.size; ++i) {
+            TraceRecord record = span[i];
+            unsigned int tid = record.tid();
+            if (!has_tid) {
+               tid = (lines + i) % fake_tids;
+            } else if (check_tids) {
+               check_tid(tid);
+            }
+            sweep[0]->memAccess(record.address, record.type(), tid);
+         }
+         lines += span.size;
+      }
+   } else if (sweep.size() == 1) {
+      // The trace is read on a separate thread, see pipeline.h
+      TracePipeline pipeline(read_block);
+      while (const TraceBlock* block = pipeline.next()) {
+         sweep[0]->memAccessBatch(block->addrs.data(), block->types.data(), 
+                                  block->tids.data(), block->size);
+         lines += block->size;
+      }
+   } else {
+      // The trace is read once on this thread, and the systems are
+      // simulated on the others
+      lines = simulateSweep(read_block, sweep, jobs);
+   }
+
+   for (size_t i = 0; i < systems.size(); ++i) {
+      sweep[i]->sync();
+      if (systems.size() > 1) {
+         cout << (i ? "\n" : "") << "Config: " << configString(configs[i]) << endl;
+      }
+      if (sample_interval) {
+         // Stats of the detail windows, then estimates for the whole trace
+         auto& sampled = static_cast<const SampledSystem&>(*sweep[i]);
+         printStats(sampled.stats, sampled.stats.accesses, 
+                    configs[i].countCompulsory);
+         cout << "Sampled windows: " << sampled.getWindows().size() 
+              << " of " << lines << " accesses" << endl;
+         printEstimate(sampled.estimate(&SystemStats::hits), lines);
+         continue;
+      }
+      if (configs[i].setSampling > 1) {
+         // The stats of the sampled sets, scaled up to the whole trace
+         const SystemStats& stats = sweep[i]->stats;
+         double scale = stats.accesses ? (double) lines / stats.accesses : 0;
+         printStats(stats.scaled(scale), lines, configs[i].countCompulsory);
+         cout << "Sampled sets: 1 in " << configs[i].setSampling << ", "
+              << stats.accesses << " of " << lines << " accesses" << endl;
+         printEstimate(sweep[i]->estimateHitRate(), lines);
+         continue;
+      }
+      printStats(sweep[i]->stats, lines, configs[i].countCompulsory);
+      if (configs[i].type == SystemType::Stack) {
+         auto& stack = static_cast<const StackDistanceSystem&>(*sweep[i]);
+         vector<uint64_t> misses = stack.missCurve();
+         cout << "Misses by associativity:" << endl;
+         for (unsigned int assoc = 1; assoc <= misses.size(); ++assoc) {
+            cout << "   " << assoc << ": " << misses[assoc - 1] << endl;
+         }
+      }
+   }
 
    return 0;
 }
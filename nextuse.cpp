@@ -0,0 +1,136 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <cassert>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "nextuse.h"
+
+constexpr uint64_t NextUseIndex::initialCapacity;
+
+NextUseIndex::NextUseIndex(unsigned int line_size, int index_fd, 
+                           uint32_t* index_map, uint64_t index_capacity) : 
+   lineSize(line_size), fd(index_fd), map(index_map), 
+   capacity(index_capacity)
+{
+   assert(line_size > 0 && (line_size & (line_size - 1)) == 0);
+   assert(fd >= 0 && map != MAP_FAILED);
+}
+
+NextUseIndex::~NextUseIndex()
+{
+   munmap(map, capacity * sizeof(*map));
+   close(fd);
+}
+
+bool NextUseIndex::grow(uint64_t n, std::string& error)
+{
+   uint64_t new_capacity = capacity;
+   while (new_capacity < n) {
+      new_capacity *= 2;
+   }
+
+   if (ftruncate(fd, new_capacity * sizeof(*map)) != 0) {
+      error = std::string("cannot grow the next-use index: ") + 
+              strerror(errno);
+      return false;
+   }
+   void* new_map = mremap(map, capacity * sizeof(*map), 
+                          new_capacity * sizeof(*map), MREMAP_MAYMOVE);
+   if (new_map == MAP_FAILED) {
+      error = std::string("cannot map the next-use index: ") + 
+              strerror(errno);
+      return false;
+   }
+   map = (uint32_t*) new_map;
+   capacity = new_capacity;
+   return true;
+}
+
+bool NextUseIndex::add(const uint64_t* addrs, size_t n, std::string& error)
+{
+   if (accesses + n > capacity && !grow(accesses + n, error)) {
+      return false;
+   }
+
+   for (size_t i = 0; i < n; ++i) {
+      record(addrs[i]);
+   }
+   return true;
+}
+
+void NextUseIndex::finish()
+{
+   std::unordered_map<uint64_t, uint64_t>().swap(lastUse);
+   madvise(map, capacity * sizeof(*map), MADV_SEQUENTIAL);
+}
+
+void NextUseIndex::release(uint64_t i)
+{
+   const uint64_t page_size = sysconf(_SC_PAGESIZE);
+   uint64_t end = (i * sizeof(*map)) & ~(page_size - 1);
+   if (end > releasedEnd) {
+      madvise((char*) map + releasedEnd, end - releasedEnd, MADV_DONTNEED);
+      releasedEnd = end;
+   }
+}
+
+std::shared_ptr<NextUseIndex> makeNextUseIndex(unsigned int line_size,
+                                               const std::string& dir, 
+                                               std::string& error)
+{
+   std::string index_dir = dir;
+   if (index_dir.empty()) {
+      const char* tmpdir = getenv("TMPDIR");
+      index_dir = tmpdir && *tmpdir ? tmpdir : "/tmp";
+   }
+   std::string path = index_dir + "/nextuse.XXXXXX";
+   int fd = mkstemp(&path[0]);
+   if (fd < 0) {
+      error = "cannot create an index file in " + index_dir + ": " + 
+              strerror(errno);
+      return nullptr;
+   }
+   // Removed once closed
+   unlink(path.c_str());
+
+   // The file is sparse, so every distance starts at 0
+   const uint64_t capacity = NextUseIndex::initialCapacity;
+   void* map = MAP_FAILED;
+   if (ftruncate(fd, capacity * sizeof(uint32_t)) == 0) {
+      map = mmap(nullptr, capacity * sizeof(uint32_t), 
+                 PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+   }
+   if (map == MAP_FAILED) {
+      error = "cannot create an index file in " + index_dir + ": " + 
+              strerror(errno);
+      close(fd);
+      return nullptr;
+   }
+   return std::make_shared<NextUseIndex>(line_size, fd, (uint32_t*) map, 
+                                         capacity);
+}
@@ -0,0 +1,111 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+// The distance from each access of a trace to the next access to the
+// same line, built in a first pass over the trace for OptPolicy (see
+// replacement.h). Distances are 32-bit, and 0 if the line is not
+// accessed again within 2^32 - 1 accesses. The index is kept in a
+// temporary file that is mapped, grown as accesses are added and
+// unlinked as soon as it is created (see makeNextUseIndex), so the
+// index of a large trace doesn't have to fit in memory. Only the map
+// from each line to its last access does, which is the size of the
+// trace's footprint.
+// Lines are virtual, which gives the same distances as physical lines
+// since translation maps each virtual page to its own physical page
+class NextUseIndex {
+public:
+   // Keeps the index in index_fd, an open file which it closes, mapped
+   // at index_map and sized to hold index_capacity distances
+   NextUseIndex(unsigned int line_size, int index_fd, uint32_t* index_map,
+                uint64_t index_capacity);
+   ~NextUseIndex();
+   NextUseIndex(const NextUseIndex&) = delete;
+   NextUseIndex& operator=(const NextUseIndex&) = delete;
+
+   // Adds the next access of the trace. Returns false and sets error if
+   // the file can't be grown to hold it
+   bool add(uint64_t address, std::string& error)
+   {
+      if (accesses == capacity && !grow(accesses + 1, error)) {
+         return false;
+      }
+      record(address);
+      return true;
+   }
+   // Adds the next n accesses of the trace, as above
+   bool add(const uint64_t* addrs, size_t n, std::string& error);
+   // Called after the last access is added, before the distances are
+   // read
+   void finish();
+
+   uint64_t size() const { return accesses; }
+   unsigned int getLineSize() const { return lineSize; }
+   // Distance from access i to the next access to its line, or 0
+   uint32_t distance(uint64_t i) const { return map[i]; }
+   // Drops the mapped pages holding the distances before access i,
+   // which will not be read again
+   void release(uint64_t i);
+   // Distances a new index holds
+   static constexpr uint64_t initialCapacity = 1 << 20;
+private:
+   unsigned int lineSize;
+   int fd;
+   uint32_t* map;
+   uint64_t capacity; // Distances the file and mapping hold
+   uint64_t accesses{0};
+   uint64_t releasedEnd{0}; // Byte offset, see release
+   // Position of the last access to each line
+   std::unordered_map<uint64_t, uint64_t> lastUse;
+
+   // Doubles the capacity until it holds at least n distances. Returns
+   // false and sets error if the file can't be grown or remapped
+   bool grow(uint64_t n, std::string& error);
+   // Adds an access the capacity holds, setting the distance of the
+   // previous access to its line. Those are mostly recent, so the pages
+   // written stay in memory
+   void record(uint64_t address)
+   {
+      auto it = lastUse.emplace(address & ~((uint64_t) lineSize - 1), accesses);
+      if (!it.second) {
+         uint64_t distance = accesses - it.first->second;
+         map[it.first->second] = distance > UINT32_MAX ? 0 : distance;
+         it.first->second = accesses;
+      }
+      ++accesses;
+   }
+};
+
+// Creates a NextUseIndex kept in a file in dir, or in $TMPDIR (/tmp if
+// it is not set) if dir is empty. /tmp is often a tmpfs, which is held
+// in memory, so a large trace's index may need a directory on disk.
+// Returns null and sets error if the file can't be created or mapped
+std::shared_ptr<NextUseIndex> makeNextUseIndex(unsigned int line_size,
+                                               const std::string& dir, 
+                                               std::string& error);
@@ -0,0 +1,291 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <cassert>
+
+#include "parallel.h"
+
+constexpr size_t ShardedSystem::batchSize;
+
+ShardedSystem::ShardedSystem(unsigned int line_size, unsigned int num_lines, 
+            unsigned int assoc, unsigned int num_workers, 
+            bool count_compulsory, bool do_addr_trans) :
+            System(line_size, num_lines, assoc, nullptr, count_compulsory, 
+                   do_addr_trans),
+            workerMask(num_workers - 1), workerShift(__builtin_ctz(num_workers))
+{
+   assert(num_workers > 0 && (num_workers & workerMask) == 0);
+   assert(num_workers <= num_lines / assoc);
+
+   workers.reserve(num_workers);
+   for (unsigned int i = 0; i < num_workers; ++i) {
+      workers.push_back(std::make_unique<Worker>());
+   }
+}
+
+void ShardedSystem::startWorkers()
+{
+   for (auto& worker : workers) {
+      worker->thread = std::thread(&ShardedSystem::run, this, std::ref(*worker));
+   }
+}
+
+void ShardedSystem::stopWorkers()
+{
+   stop.store(true, std::memory_order_relaxed);
+   for (auto& worker : workers) {
+      worker->thread.join();
+   }
+}
+
+void ShardedSystem::run(Worker& worker)
+{
+   while (!stop.load(std::memory_order_relaxed)) {
+      Batch* batch = worker.ring.consumerSlot();
+      if (!batch) {
+         std::this_thread::yield();
+         continue;
+      }
+
+      simulate(*worker.sys, *batch);
+      worker.ring.pop();
+   }
+}
+
+void ShardedSystem::waitForBatch(Worker& worker)
+{
+   while (!(worker.filling = worker.ring.producerSlot())) {
+      std::this_thread::yield();
+   }
+   worker.filling->size = 0;
+}
+
+void ShardedSystem::submit(Worker& worker)
+{
+   worker.ring.push();
+   worker.filling = nullptr;
+}
+
+void ShardedSystem::sync()
+{
+   for (auto& worker : workers) {
+      if (worker->filling && worker->filling->size > 0) {
+         submit(*worker);
+      }
+   }
+
+   // The caches of each worker follow those of the one before
+   stats = SystemStats();
+   for (auto& worker : workers) {
+      while (!worker->ring.drained()) {
+         std::this_thread::yield();
+      }
+      worker->sys->sync();
+      const SystemStats& worker_stats = worker->sys->stats;
+      stats += static_cast<const AccessCounts&>(worker_stats);
+      stats.replacement.addCaches(worker_stats.replacement);
+   }
+}
+
+ParallelSingleCacheSystem::ParallelSingleCacheSystem(unsigned int line_size, 
+            unsigned int num_lines, unsigned int assoc, unsigned int workers,
+            bool count_compulsory /*=false*/, bool do_addr_trans /*=false*/,
+            const ReplacementConfig& replacement /*={}*/) :
+            ShardedSystem(line_size, num_lines, assoc, workers, 
+                          count_compulsory, do_addr_trans)
+{
+   assert(isPerSet(replacement.type));
+   // Translation is done by the caller, so the workers' page numbers
+   // are assigned in trace order
+   for (auto& worker : this->workers) {
+      worker->sys = makeSingleCacheSystem(line_size, num_lines / workers, 
+                        assoc, nullptr, count_compulsory, false, 1, 
+                        replacement);
+   }
+   startWorkers();
+}
+
+ParallelSingleCacheSystem::~ParallelSingleCacheSystem()
+{
+   stopWorkers();
+}
+
+// The worker's cache has the sets of this one with the same number
+// modulo workers, so set s is set s / workers in it. The set bits
+// above those of the worker's cache are cleared, which leaves the tags
+// of lines in the same set unchanged
+void ParallelSingleCacheSystem::dispatch(uint64_t address, AccessType type,
+                                         bool skip /*=false*/)
+{
+   if (doAddrTrans) {
+      address = virtToPhys(address);
+   }
+   // Only the workers' compulsory misses need the skipped accesses
+   if (skip && !countCompulsory) {
+      return;
+   }
+
+   uint64_t set = (address & setMask) >> setShift;
+   Batch& batch = batchFor(set, skip);
+   batch.addrs[batch.size] = (address & ~setMask) | 
+                             ((set >> workerShift) << setShift);
+   batch.types[batch.size] = type;
+   // Only the prefetcher uses TIDs, and the workers have none
+   batch.tids[batch.size] = 0;
+   added(set);
+}
+
+void ParallelSingleCacheSystem::simulate(System& sys, const Batch& batch)
+{
+   if (batch.skip) {
+      sys.skipBatch(batch.addrs.data(), batch.tids.data(), batch.size);
+      return;
+   }
+   sys.memAccessBatch(batch.addrs.data(), batch.types.data(), 
+                      batch.tids.data(), batch.size);
+}
+
+void ParallelSingleCacheSystem::memAccess(uint64_t address, AccessType type, 
+                                          unsigned int)
+{
+   dispatch(address, type);
+}
+
+void ParallelSingleCacheSystem::memAccessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int*, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      dispatch(addrs[i], types[i]);
+   }
+}
+
+void ParallelSingleCacheSystem::skipBatch(const uint64_t* addrs, 
+                                          const unsigned int*, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      dispatch(addrs[i], AccessType::Read, true);
+   }
+}
+
+// Holds one shard of a MultiCacheSystem's sets, simulating accesses
+// with the page placements made by the caller
+class MultiCacheShard final : public MultiCacheSystem {
+public:
+   MultiCacheShard(std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            bool count_compulsory, unsigned int num_domains, 
+            unsigned int shards, unsigned int shard,
+            const ReplacementConfig& replacement) :
+            MultiCacheSystem(tid_to_domain, line_size, num_lines, assoc, 
+                  count_compulsory, num_domains, shards, shard, replacement) {}
+
+   using MultiCacheSystem::accessPlaced;
+
+   // Pages are placed by the caller, see ParallelMultiCacheSystem
+   void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                  size_t n) override
+   { System::skipBatch(addrs, tids, n); }
+};
+
+ParallelMultiCacheSystem::ParallelMultiCacheSystem(
+            std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            unsigned int workers, bool count_compulsory /*=false*/, 
+            bool do_addr_trans /*=false*/, unsigned int num_domains /*=1*/,
+            const ReplacementConfig& replacement /*={}*/) :
+            ShardedSystem(line_size, num_lines, assoc, workers, 
+                          count_compulsory, do_addr_trans),
+            tidToDomain(tid_to_domain)
+{
+   assert(isPerSet(replacement.type));
+   for (unsigned int i = 0; i < workers; ++i) {
+      this->workers[i]->sys = std::make_unique<MultiCacheShard>(tid_to_domain,
+                  line_size, num_lines, assoc, count_compulsory, num_domains, 
+                  workers, i, replacement);
+   }
+   startWorkers();
+}
+
+ParallelMultiCacheSystem::~ParallelMultiCacheSystem()
+{
+   stopWorkers();
+}
+
+void ParallelMultiCacheSystem::dispatch(uint64_t address, AccessType type, 
+                                        unsigned int tid, bool skip /*=false*/)
+{
+   if (doAddrTrans) {
+      address = virtToPhys(address);
+   }
+
+   uint64_t page = address & pageMask;
+   if (page != lastPage) {
+      lastPage = page;
+      lastDomain = pageToDomain.emplace(page, tidToDomain[tid]).first->second;
+   }
+   // Only the workers' compulsory misses need the skipped accesses
+   if (skip && !countCompulsory) {
+      return;
+   }
+
+   uint64_t set = (address & setMask) >> setShift;
+   Batch& batch = batchFor(set, skip);
+   batch.addrs[batch.size] = address;
+   batch.types[batch.size] = type;
+   batch.tids[batch.size] = tid;
+   batch.touchDomains[batch.size] = lastDomain;
+   added(set);
+}
+
+void ParallelMultiCacheSystem::simulate(System& sys, const Batch& batch)
+{
+   if (batch.skip) {
+      sys.skipBatch(batch.addrs.data(), batch.tids.data(), batch.size);
+      return;
+   }
+   static_cast<MultiCacheShard&>(sys).accessPlaced(batch.addrs.data(), 
+         batch.types.data(), batch.tids.data(), batch.touchDomains.data(), 
+         batch.size);
+}
+
+void ParallelMultiCacheSystem::memAccess(uint64_t address, AccessType type, 
+                                         unsigned int tid)
+{
+   dispatch(address, type, tid);
+}
+
+void ParallelMultiCacheSystem::memAccessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      dispatch(addrs[i], types[i], tids[i]);
+   }
+}
+
+void ParallelMultiCacheSystem::skipBatch(const uint64_t* addrs, 
+                                         const unsigned int* tids, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      dispatch(addrs[i], AccessType::Read, tids[i], true);
+   }
+}
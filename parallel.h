@@ -0,0 +1,177 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <unordered_map>
+
+#include "misc.h"
+#include "system.h"
+#include "spsc.h"
+
+// Base of the systems below, which divide the sets of the simulated
+// caches between worker threads. Without a prefetcher, an access only
+// affects the lines of its own set (in every cache), so each worker
+// owns the sets s with s % workers equal to its number, with the same
+// results as simulating every set on one thread. That only holds for
+// replacement policies where isPerSet is true, so the others (such as
+// DRRIP, whose set dueling spans every set) can't be divided.
+// The calling thread
+// translates each access in trace order and queues it for the worker
+// owning its set, and sync sums the workers' stats.
+// workers must be a power of 2 no larger than the number of sets
+class ShardedSystem : public System {
+public:
+   ShardedSystem(const ShardedSystem&) = delete;
+   ShardedSystem& operator=(const ShardedSystem&) = delete;
+
+   void sync() override;
+protected:
+   static constexpr size_t batchSize = 4096;
+   static constexpr size_t batchesQueued = 16;
+
+   // Accesses queued for a worker
+   struct Batch {
+      std::vector<uint64_t> addrs;
+      std::vector<AccessType> types;
+      std::vector<unsigned int> tids;
+      // Domain that first touched the page of each address
+      std::vector<unsigned int> touchDomains;
+      size_t size{0};
+      // Set if the accesses are only to be marked as seen, see
+      // System::skipBatch
+      bool skip{false};
+
+      Batch() : addrs(batchSize), types(batchSize), tids(batchSize), 
+                touchDomains(batchSize) {}
+   };
+
+   struct Worker {
+      std::unique_ptr<System> sys; // Simulates the worker's sets
+      SpscRing<Batch> ring{batchesQueued};
+      Batch* filling{nullptr}; // Batch being filled by the caller
+      std::thread thread;
+   };
+
+   std::vector<std::unique_ptr<Worker>> workers;
+   uint64_t workerMask;
+   uint32_t workerShift;
+
+   ShardedSystem(unsigned int line_size, unsigned int num_lines, 
+                 unsigned int assoc, unsigned int num_workers, 
+                 bool count_compulsory, bool do_addr_trans);
+   // Called by the derived classes once the workers' systems have been
+   // created, and before they are destroyed
+   void startWorkers();
+   void stopWorkers();
+   // Returns the batch of the worker owning set, which has room for an
+   // access at its size. Skipped and simulated accesses go in separate
+   // batches
+   Batch& batchFor(uint64_t set, bool skip = false)
+   {
+      Worker& worker = *workers[set & workerMask];
+      if (worker.filling && worker.filling->skip != skip && 
+          worker.filling->size > 0) {
+         submit(worker);
+      }
+      if (!worker.filling) {
+         waitForBatch(worker);
+      }
+      worker.filling->skip = skip;
+      return *worker.filling;
+   }
+   // Queues the batch of the worker owning set if it is full
+   void added(uint64_t set)
+   {
+      Worker& worker = *workers[set & workerMask];
+      if (++worker.filling->size == batchSize) {
+         submit(worker);
+      }
+   }
+   // Simulates a batch on a worker's thread
+   virtual void simulate(System& sys, const Batch& batch) = 0;
+private:
+   std::atomic<bool> stop{false};
+
+   void waitForBatch(Worker& worker);
+   void submit(Worker& worker);
+   void run(Worker& worker);
+};
+
+// A SingleCacheSystem divided between workers. Each simulates its sets
+// as a SingleCacheSystem with 1/workers of the sets
+class ParallelSingleCacheSystem final : public ShardedSystem {
+public:
+   ParallelSingleCacheSystem(unsigned int line_size, unsigned int num_lines,
+               unsigned int assoc, unsigned int workers, 
+               bool count_compulsory=false, bool do_addr_trans=false,
+               const ReplacementConfig& replacement={});
+   ~ParallelSingleCacheSystem();
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                  size_t n) override;
+private:
+   void dispatch(uint64_t address, AccessType type, bool skip = false);
+   void simulate(System& sys, const Batch& batch) override;
+};
+
+// A MultiCacheSystem divided between workers. Each worker has the same
+// sets of every domain's cache, so the coherence actions of an access,
+// which only involve its set, happen on one worker. Pages are placed
+// in the domain that first touches them in trace order by the calling
+// thread, which passes the placement of each page along with its
+// accesses
+class ParallelMultiCacheSystem final : public ShardedSystem {
+public:
+   ParallelMultiCacheSystem(std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            unsigned int workers, bool count_compulsory=false, 
+            bool do_addr_trans=false, unsigned int num_domains=1,
+            const ReplacementConfig& replacement={});
+   ~ParallelMultiCacheSystem();
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                  size_t n) override;
+private:
+   std::vector<unsigned int>& tidToDomain;
+   // First-touch domain of each page
+   std::unordered_map<uint64_t, unsigned int> pageToDomain;
+   // Accesses to a page tend to come in runs, so the last one is kept
+   uint64_t lastPage{~((uint64_t) 0)};
+   unsigned int lastDomain{0};
+
+   void dispatch(uint64_t address, AccessType type, unsigned int tid, 
+                 bool skip = false);
+   void simulate(System& sys, const Batch& batch) override;
+};
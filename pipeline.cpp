@@ -0,0 +1,143 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <algorithm>
+
+#include "pipeline.h"
+
+TracePipeline::TracePipeline(Reader reader, size_t num_blocks /*=16*/,
+                             size_t block_size /*=4096*/) :
+      ring(num_blocks, block_size), reader(std::move(reader)), 
+      thread(&TracePipeline::run, this)
+{
+}
+
+TracePipeline::~TracePipeline()
+{
+   // The reader stops early if the trace was not consumed
+   stop.store(true, std::memory_order_relaxed);
+   thread.join();
+}
+
+void TracePipeline::run()
+{
+   while (!stop.load(std::memory_order_relaxed)) {
+      TraceBlock* block = ring.producerSlot();
+      if (!block) {
+         std::this_thread::yield();
+         continue;
+      }
+
+      if (!reader(*block)) {
+         break;
+      }
+      ring.push();
+   }
+
+   done.store(true, std::memory_order_release);
+}
+
+TraceBlock* TracePipeline::next()
+{
+   if (holding) {
+      ring.pop();
+      holding = false;
+   }
+
+   TraceBlock* block;
+   while (!(block = ring.consumerSlot())) {
+      // Blocks pushed before done was set are seen by the next check
+      if (done.load(std::memory_order_acquire)) {
+         block = ring.consumerSlot();
+         if (!block) {
+            return nullptr;
+         }
+         break;
+      }
+      std::this_thread::yield();
+   }
+
+   holding = true;
+   return block;
+}
+
+uint64_t simulateSweep(const TracePipeline::Reader& reader, 
+                       const std::vector<System*>& systems,
+                       unsigned int threads /*=0*/, size_t num_blocks /*=16*/,
+                       size_t block_size /*=4096*/)
+{
+   if (threads == 0) {
+      threads = std::thread::hardware_concurrency();
+   }
+   threads = std::max(1U, std::min<unsigned int>(threads, systems.size()));
+
+   BroadcastRing<TraceBlock> ring(num_blocks, threads, block_size);
+   std::atomic<bool> done{false};
+
+   std::vector<std::thread> workers;
+   for (unsigned int t = 0; t < threads; ++t) {
+      workers.emplace_back([&, t] {
+         while (true) {
+            TraceBlock* block = ring.consumerSlot(t);
+            if (!block) {
+               // Blocks pushed before done was set are seen by the next check
+               if (!done.load(std::memory_order_acquire)) {
+                  std::this_thread::yield();
+                  continue;
+               }
+               block = ring.consumerSlot(t);
+               if (!block) {
+                  return;
+               }
+            }
+
+            for (size_t i = t; i < systems.size(); i += threads) {
+               systems[i]->memAccessBatch(block->addrs.data(), 
+                     block->types.data(), block->tids.data(), block->size);
+            }
+            ring.pop(t);
+         }
+      });
+   }
+
+   uint64_t accesses = 0;
+   while (true) {
+      TraceBlock* block = ring.producerSlot();
+      if (!block) {
+         std::this_thread::yield();
+         continue;
+      }
+
+      if (!reader(*block)) {
+         break;
+      }
+      accesses += block->size;
+      ring.push();
+   }
+   done.store(true, std::memory_order_release);
+
+   for (std::thread& worker : workers) {
+      worker.join();
+   }
+   return accesses;
+}
@@ -0,0 +1,72 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "spsc.h"
+#include "trace.h"
+#include "system.h"
+
+// Reads a trace on its own thread so decoding overlaps with simulation.
+// The reader fills blocks from a ring of preallocated TraceBlocks,
+// which the simulating thread takes with next()
+class TracePipeline {
+public:
+   // Fills a block and returns true, or returns false at the end of the
+   // trace. Called only on the reader thread
+   using Reader = std::function<bool(TraceBlock&)>;
+
+   explicit TracePipeline(Reader reader, size_t num_blocks = 16, 
+                          size_t block_size = 4096);
+   ~TracePipeline();
+   TracePipeline(const TracePipeline&) = delete;
+   TracePipeline& operator=(const TracePipeline&) = delete;
+
+   // Returns the next block, or nullptr at the end of the trace. The
+   // block is valid until the next call
+   TraceBlock* next();
+private:
+   SpscRing<TraceBlock> ring;
+   Reader reader;
+   std::atomic<bool> done{false};
+   std::atomic<bool> stop{false};
+   bool holding{false}; // Whether the consumer still holds a slot
+   std::thread thread;
+
+   void run();
+};
+
+// Simulates a trace on each of systems in one pass. reader fills blocks
+// as for TracePipeline, on the calling thread, and every block is
+// passed to all of the systems. The systems are divided round robin
+// between up to threads threads (one per CPU if 0). Returns the number
+// of accesses
+uint64_t simulateSweep(const TracePipeline::Reader& reader, 
+                       const std::vector<System*>& systems,
+                       unsigned int threads = 0, size_t num_blocks = 16,
+                       size_t block_size = 4096);
@@ -26,60 +26,20 @@ freely, subject to the following restrictions:
 
 int AdjPrefetch::prefetchMiss(uint64_t address, unsigned int tid, System& sys)
 {
-   sys.memAccess(address + (1 << sys.setShift), AccessType::Prefetch, tid);
-   return 1;
+   return onMiss(address, tid, sys);
 }
 
-// Called to check for prefetches in the case of a cache miss.
 int SeqPrefetch::prefetchMiss(uint64_t address, unsigned int tid, System& sys)
 {
-   uint64_t set = (address & sys.setMask) >> sys.setShift;
-   uint64_t tag = address & sys.tagMask;
-   uint64_t lastSet = (lastMiss & sys.setMask) >> sys.setShift;
-   uint64_t lastTag = lastMiss & sys.tagMask;
-   int prefetched = 0;
-
-   if(tag == lastTag && (lastSet+1) == set) {
-      for(uint64_t i=0; i < prefetchNum; i++) {
-         prefetched++;
-         // Call memAccess to resolve the prefetch. The address is 
-         // incremented in the set portion of its bits (least
-         // significant bits not in the cache line offset portion)
-         sys.memAccess(address + ((1 << sys.setShift) * (i+1)), 
-                           AccessType::Prefetch, tid);
-      }
-      
-      lastPrefetch = address + (1 << sys.setShift);
-   }
-
-   lastMiss = address;
-   return prefetched;
+   return onMiss(address, tid, sys);
 }
 
 int AdjPrefetch::prefetchHit(uint64_t address, unsigned int tid, System& sys)
 {
-   sys.memAccess(address + (1 << sys.setShift), AccessType::Prefetch, tid);
-   return 1;
+   return onHit(address, tid, sys);
 }
 
-// Called to check for prefetches in the case of a cache hit.
 int SeqPrefetch::prefetchHit(uint64_t address, unsigned int tid, System& sys)
 {
-   uint64_t set = (address & sys.setShift) >> sys.setShift;
-   uint64_t tag = address & sys.tagMask;
-   uint64_t lastSet = (lastPrefetch & sys.setMask) 
-                                    >> sys.setShift;
-   uint64_t lastTag = lastPrefetch & sys.tagMask;
-
-   if(tag == lastTag && lastSet == set) {
-      // Call memAccess to resolve the prefetch. The address is 
-      // incremented in the set portion of its bits (least
-      // significant bits not in the cache line offset portion)
-      sys.memAccess(address + ((1 << sys.setShift) * prefetchNum), 
-                        AccessType::Prefetch, tid);
-      lastPrefetch = lastPrefetch + (1 << sys.setShift);
-   }
-
-   return 1;
+   return onHit(address, tid, sys);
 }
-
@@ -25,16 +25,24 @@ freely, subject to the following restrictions:
 
 #include <cstdint>
 
+#include "misc.h"
+
 class System;
 
 class Prefetch {
 public:
+   virtual ~Prefetch() = default;
    virtual int prefetchMiss(uint64_t address, unsigned int tid, 
                               System& sys) = 0;
    virtual int prefetchHit(uint64_t address, unsigned int tid,
                               System& sys) = 0;
 };
 
+// The prefetchers below also provide onMiss and onHit templates, which
+// do the work of prefetchMiss and prefetchHit for a known system type.
+// When the system is a final class its memAccess calls are direct, so
+// the whole prefetch can be inlined, see PrefetchCall
+
 // Modeling AMD's L1 prefetcher, a sequential
 // line prefetcher. Primary difference is that
 // the real prefetcher has a dynamic prefetch width.
@@ -42,6 +50,8 @@ class SeqPrefetch : public Prefetch {
 public:
    int prefetchMiss(uint64_t address, unsigned int tid, System& sys) override;
    int prefetchHit(uint64_t address, unsigned int tid, System& sys) override;
+   template <class Sys> int onMiss(uint64_t address, unsigned int tid, Sys& sys);
+   template <class Sys> int onHit(uint64_t address, unsigned int tid, Sys& sys);
 private:
    uint64_t lastMiss{0};
    uint64_t lastPrefetch{0};
@@ -53,4 +63,96 @@ class AdjPrefetch : public Prefetch {
 public:
    int prefetchMiss(uint64_t address, unsigned int tid, System& sys) override;
    int prefetchHit(uint64_t address, unsigned int tid, System& sys) override;
+   template <class Sys> int onMiss(uint64_t address, unsigned int tid, Sys& sys);
+   template <class Sys> int onHit(uint64_t address, unsigned int tid, Sys& sys);
+};
+
+// Used by the systems to call their prefetcher. Pf is the prefetcher's
+// type if it is known at compile time, Prefetch to make a virtual call,
+// or void if the system has no prefetcher
+template <class Pf>
+struct PrefetchCall {
+   template <class Sys>
+   static int miss(Prefetch* pf, uint64_t address, unsigned int tid, Sys& sys)
+   { return static_cast<Pf*>(pf)->onMiss(address, tid, sys); }
+   template <class Sys>
+   static int hit(Prefetch* pf, uint64_t address, unsigned int tid, Sys& sys)
+   { return static_cast<Pf*>(pf)->onHit(address, tid, sys); }
+};
+
+template <>
+struct PrefetchCall<Prefetch> {
+   static int miss(Prefetch* pf, uint64_t address, unsigned int tid, System& sys)
+   { return pf->prefetchMiss(address, tid, sys); }
+   static int hit(Prefetch* pf, uint64_t address, unsigned int tid, System& sys)
+   { return pf->prefetchHit(address, tid, sys); }
+};
+
+template <>
+struct PrefetchCall<void> {
+   static int miss(Prefetch*, uint64_t, unsigned int, System&) { return 0; }
+   static int hit(Prefetch*, uint64_t, unsigned int, System&) { return 0; }
 };
+
+template <class Sys>
+int AdjPrefetch::onMiss(uint64_t address, unsigned int tid, Sys& sys)
+{
+   sys.memAccess(address + (1 << sys.setShift), AccessType::Prefetch, tid);
+   return 1;
+}
+
+// Called to check for prefetches in the case of a cache miss.
+template <class Sys>
+int SeqPrefetch::onMiss(uint64_t address, unsigned int tid, Sys& sys)
+{
+   uint64_t set = (address & sys.setMask) >> sys.setShift;
+   uint64_t tag = address & sys.tagMask;
+   uint64_t lastSet = (lastMiss & sys.setMask) >> sys.setShift;
+   uint64_t lastTag = lastMiss & sys.tagMask;
+   int prefetched = 0;
+
+   if(tag == lastTag && (lastSet+1) == set) {
+      for(uint64_t i=0; i < prefetchNum; i++) {
+         prefetched++;
+         // Call memAccess to resolve the prefetch. The address is 
+         // incremented in the set portion of its bits (least
+         // significant bits not in the cache line offset portion)
+         sys.memAccess(address + ((1 << sys.setShift) * (i+1)), 
+                           AccessType::Prefetch, tid);
+      }
+      
+      lastPrefetch = address + (1 << sys.setShift);
+   }
+
+   lastMiss = address;
+   return prefetched;
+}
+
+template <class Sys>
+int AdjPrefetch::onHit(uint64_t address, unsigned int tid, Sys& sys)
+{
+   sys.memAccess(address + (1 << sys.setShift), AccessType::Prefetch, tid);
+   return 1;
+}
+
+// Called to check for prefetches in the case of a cache hit.
+template <class Sys>
+int SeqPrefetch::onHit(uint64_t address, unsigned int tid, Sys& sys)
+{
+   uint64_t set = (address & sys.setMask) >> sys.setShift;
+   uint64_t tag = address & sys.tagMask;
+   uint64_t lastSet = (lastPrefetch & sys.setMask) 
+                                    >> sys.setShift;
+   uint64_t lastTag = lastPrefetch & sys.tagMask;
+
+   if(tag == lastTag && lastSet == set) {
+      // Call memAccess to resolve the prefetch. The address is 
+      // incremented in the set portion of its bits (least
+      // significant bits not in the cache line offset portion)
+      sys.memAccess(address + ((1 << sys.setShift) * prefetchNum), 
+                        AccessType::Prefetch, tid);
+      lastPrefetch = lastPrefetch + (1 << sys.setShift);
+   }
+
+   return 1;
+}
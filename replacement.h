@@ -0,0 +1,731 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <algorithm>
+#include <memory>
+
+#include "nextuse.h"
+
+// Replacement policies for BasicCache, which picks which way of a full
+// set to replace by asking its Policy. A policy keeps its own state for
+// every set, in a compact array of its own, and is told of each hit,
+// fill and invalidation. Ways are numbered within their set, and the
+// associativity is passed to every call so that it is a constant
+// wherever BasicCache's is. A policy provides:
+//
+//    Policy(uint64_t num_sets, unsigned int assoc, 
+//           const ReplacementConfig& config)
+//    // The line in way was hit
+//    void touch(uint64_t set, unsigned int way, unsigned int assoc)
+//    // A new line was placed in way, which victim returned, or which
+//    // was empty if tracksEmpty is false
+//    void fill(uint64_t set, unsigned int way, unsigned int assoc)
+//    // The line in way was removed, so the way is empty
+//    void invalidate(uint64_t set, unsigned int way, unsigned int assoc)
+//    // The way the next fill of the set will replace
+//    unsigned int victim(uint64_t set, unsigned int assoc) const
+//    // Hints the host to bring the set's state into its cache
+//    void prefetch(uint64_t set, unsigned int assoc) const
+//    // If true, victim returns an empty way whenever the set has one.
+//    // Otherwise BasicCache searches the set for one first
+//    bool tracksEmpty() const
+//    // The policy's own stats, see ReplacementStats
+//    ReplacementStats getStats() const
+//
+// Policies are passed by type, so the calls are inlined into the cache
+
+enum class ReplacementType {
+   Lru, 
+   // Tree pseudo-LRU, for power of 2 associativities up to 64
+   TreePlru, 
+   // MRU bit per way, up to 64 ways
+   BitPlru,
+   // Re-reference interval prediction, inserting lines at a long
+   // interval (SRRIP), mostly at a distant one (BRRIP), or as whichever
+   // of the two misses less in a few leader sets (DRRIP)
+   Srrip,
+   Brrip,
+   Drrip,
+   // Belady's optimal replacement, from a NextUseIndex of the trace
+   Opt,
+   // A pseudo-random way, from a generator seeded by the config
+   Random,
+   // Round robin over the ways of each set
+   Fifo,
+};
+
+// Whether the lines a policy replaces in a set depend only on the
+// accesses to that set, so its sets can be divided between caches and
+// simulated apart, see parallel.h
+inline bool isPerSet(ReplacementType type)
+{
+   return type != ReplacementType::Brrip && type != ReplacementType::Drrip &&
+          type != ReplacementType::Opt && type != ReplacementType::Random;
+}
+
+// Options of the policies, chosen at run time
+struct ReplacementConfig {
+   ReplacementType type;
+   // The trace's next uses, required by Opt
+   std::shared_ptr<NextUseIndex> nextUse;
+   // Seeds Random's generator
+   uint64_t seed{0};
+   // Number of the cache within its system, set by systems with several
+   // so each cache draws a different sequence from the same seed
+   uint64_t stream{0};
+
+   // So a policy's config can be given as just its type
+   ReplacementConfig(ReplacementType type = ReplacementType::Lru) : 
+         type(type) {}
+};
+
+// Stats kept by the policies that have any, and left at 0 by the others
+struct ReplacementStats {
+   // Lines inserted at each RRPV by the RRIP policies
+   uint64_t rrpvInserts[4]{0, 0, 0, 0};
+   // DRRIP's PSEL counter after every RripPolicy::pselPeriod fills,
+   // oldest first, for each cache with one. Each cache has its own
+   // counter, so systems with several caches have several, in the
+   // order of their caches
+   std::vector<std::vector<uint16_t>> psel;
+
+   // Adds the counts, and appends the samples of each cache of rhs to
+   // the same cache's here. rhs must follow these in time
+   ReplacementStats& operator+=(const ReplacementStats& rhs)
+   {
+      addCounts(rhs, 1);
+      if (psel.size() < rhs.psel.size()) {
+         psel.resize(rhs.psel.size());
+      }
+      for (size_t c = 0; c < rhs.psel.size(); ++c) {
+         psel[c].insert(psel[c].end(), rhs.psel[c].begin(), rhs.psel[c].end());
+      }
+      return *this;
+   }
+
+   // Removes the counts and samples of an earlier copy
+   ReplacementStats& operator-=(const ReplacementStats& rhs)
+   {
+      addCounts(rhs, -1);
+      for (size_t c = 0; c < std::min(psel.size(), rhs.psel.size()); ++c) {
+         psel[c].erase(psel[c].begin(), psel[c].begin() + 
+                       std::min(psel[c].size(), rhs.psel[c].size()));
+      }
+      return *this;
+   }
+
+   // Adds the counts of other caches over the same time, whose PSEL
+   // samples follow these caches'
+   ReplacementStats& addCaches(const ReplacementStats& rhs)
+   {
+      addCounts(rhs, 1);
+      psel.insert(psel.end(), rhs.psel.begin(), rhs.psel.end());
+      return *this;
+   }
+private:
+   void addCounts(const ReplacementStats& rhs, int64_t sign)
+   {
+      for (unsigned int i = 0; i < 4; ++i) {
+         rrpvInserts[i] += sign * rhs.rrpvInserts[i];
+      }
+   }
+};
+
+// True LRU. Each set keeps its way numbers ordered from least to most
+// recently used, with empty ways at the least recently used end
+class LruPolicy {
+public:
+   LruPolicy(uint64_t num_sets, unsigned int assoc, 
+             const ReplacementConfig& = {}) : order(num_sets * assoc) 
+   {
+      for (uint64_t i = 0; i < order.size(); ++i) {
+         order[i] = i % assoc;
+      }
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int assoc)
+   { moveTo(set, way, assoc - 1, assoc); }
+
+   // The victim is at the front, so shifting the order down by one
+   // moves it to the most recently used end
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      uint16_t* set_order = &order[set * assoc];
+      std::memmove(set_order, set_order + 1, (assoc - 1) * sizeof(*set_order));
+      set_order[assoc - 1] = way;
+   }
+
+   void invalidate(uint64_t set, unsigned int way, unsigned int assoc)
+   { moveTo(set, way, 0, assoc); }
+
+   unsigned int victim(uint64_t set, unsigned int assoc) const
+   { return order[set * assoc]; }
+
+   void prefetch(uint64_t set, unsigned int assoc) const
+   { __builtin_prefetch(&order[set * assoc]); }
+
+   bool tracksEmpty() const { return true; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   std::vector<uint16_t> order;
+
+   // Moves way to position pos of its set's order
+   void moveTo(uint64_t set, unsigned int way, unsigned int pos, 
+               unsigned int assoc)
+   {
+      uint16_t* set_order = &order[set * assoc];
+      unsigned int cur = 0;
+
+      while (set_order[cur] != way) {
+         ++cur;
+      }
+
+      if (cur < pos) {
+         std::memmove(set_order + cur, set_order + cur + 1, 
+                      (pos - cur) * sizeof(*set_order));
+      } else {
+         std::memmove(set_order + pos + 1, set_order + pos, 
+                      (cur - pos) * sizeof(*set_order));
+      }
+      set_order[pos] = way;
+   }
+};
+
+// Tree pseudo-LRU, as in most L1 and L2 caches. The ways of a set are
+// the leaves of a binary tree, whose assoc - 1 nodes are stored as bits
+// 1 to assoc - 1 of a word per set, numbered as a heap (the children of
+// node n are 2n and 2n + 1). A set bit points the victim search to the
+// right. An access points every node on its way's path away from it,
+// which is one mask and one OR with the path tables
+class TreePlruPolicy {
+public:
+   TreePlruPolicy(uint64_t num_sets, unsigned int assoc, 
+                  const ReplacementConfig& = {}) : 
+               bits(num_sets, 0), pathMask(assoc), pathBits(assoc)
+   {
+      assert(assoc <= 64 && (assoc & (assoc - 1)) == 0);
+      for (unsigned int way = 0; way < assoc; ++way) {
+         for (unsigned int node = assoc + way; node > 1; node >>= 1) {
+            const uint64_t parent = (uint64_t) 1 << (node >> 1);
+            pathMask[way] |= parent;
+            // A left child points its parent right
+            if (!(node & 1)) {
+               pathBits[way] |= parent;
+            }
+         }
+      }
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int)
+   { bits[set] = (bits[set] & ~pathMask[way]) | pathBits[way]; }
+
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   { touch(set, way, assoc); }
+
+   // Empty ways are found by BasicCache
+   void invalidate(uint64_t, unsigned int, unsigned int) {}
+
+   unsigned int victim(uint64_t set, unsigned int assoc) const
+   {
+      const uint64_t set_bits = bits[set];
+      unsigned int node = 1;
+      while (node < assoc) {
+         node = 2 * node + ((set_bits >> node) & 1);
+      }
+      return node - assoc;
+   }
+
+   void prefetch(uint64_t set, unsigned int) const
+   { __builtin_prefetch(&bits[set]); }
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   std::vector<uint64_t> bits;
+   // The nodes on the path to each way, and their values after the way
+   // is accessed
+   std::vector<uint64_t> pathMask;
+   std::vector<uint64_t> pathBits;
+};
+
+// Bit pseudo-LRU (MRU bits). Each way has a bit, set when it is
+// accessed, and the victim is the first way whose bit is clear. Once
+// every bit would be set, all but the accessed way's are cleared
+class BitPlruPolicy {
+public:
+   BitPlruPolicy(uint64_t num_sets, unsigned int assoc, 
+                 const ReplacementConfig& = {}) : 
+               bits(num_sets, 0), 
+               full(assoc == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << assoc) - 1)
+   {
+      assert(assoc <= 64);
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int)
+   {
+      const uint64_t way_bit = (uint64_t) 1 << way;
+      const uint64_t set_bits = bits[set] | way_bit;
+      bits[set] = set_bits == full ? way_bit : set_bits;
+   }
+
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   { touch(set, way, assoc); }
+
+   void invalidate(uint64_t set, unsigned int way, unsigned int)
+   { bits[set] &= ~((uint64_t) 1 << way); }
+
+   unsigned int victim(uint64_t set, unsigned int) const
+   { return __builtin_ctzll(~bits[set]); }
+
+   void prefetch(uint64_t set, unsigned int) const
+   { __builtin_prefetch(&bits[set]); }
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   std::vector<uint64_t> bits;
+   uint64_t full;
+};
+
+// Replaces a random way, drawn from a xorshift64* generator in each
+// cache so runs with the same seed replace the same lines. Hits change
+// nothing, and each fill draws the next victim, which is shared by all
+// sets. The sequence depends on the order of fills across sets, so the
+// sets can't be divided between workers
+class RandomPolicy {
+public:
+   RandomPolicy(uint64_t, unsigned int, const ReplacementConfig& config = {}) :
+         state(splitmix(splitmix(config.seed) + config.stream)), 
+         next(state * multiplier) {}
+
+   void touch(uint64_t, unsigned int, unsigned int) {}
+
+   void fill(uint64_t, unsigned int, unsigned int)
+   {
+      state ^= state >> 12;
+      state ^= state << 25;
+      state ^= state >> 27;
+      next = state * multiplier;
+   }
+
+   void invalidate(uint64_t, unsigned int, unsigned int) {}
+
+   // The high bits are the random ones, scaled to the associativity
+   // without a division
+   unsigned int victim(uint64_t, unsigned int assoc) const
+   { return ((next >> 32) * assoc) >> 32; }
+
+   void prefetch(uint64_t, unsigned int) const {}
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   static constexpr uint64_t multiplier = 0x2545F4914F6CDD1DULL;
+
+   uint64_t state;
+   uint64_t next;
+
+   // Spreads the seed over the state, which must not be 0
+   static uint64_t splitmix(uint64_t seed)
+   {
+      uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      z ^= z >> 31;
+      return z ? z : 1;
+   }
+};
+
+// First in, first out. Each set points at its oldest way, which is
+// replaced and the pointer moved to the next way, round robin as in
+// hardware. Hits change nothing. A line filled into a way emptied by
+// an invalidation doesn't move the pointer, so it may be replaced
+// before older lines
+class FifoPolicy {
+public:
+   FifoPolicy(uint64_t num_sets, unsigned int assoc, 
+              const ReplacementConfig& = {}) : oldest(num_sets, 0) 
+   {
+      assert(assoc <= 65536);
+   }
+
+   void touch(uint64_t, unsigned int, unsigned int) {}
+
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      if (way == oldest[set]) {
+         oldest[set] = way + 1 == assoc ? 0 : way + 1;
+      }
+   }
+
+   void invalidate(uint64_t, unsigned int, unsigned int) {}
+
+   unsigned int victim(uint64_t set, unsigned int) const
+   { return oldest[set]; }
+
+   void prefetch(uint64_t set, unsigned int) const
+   { __builtin_prefetch(&oldest[set]); }
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   std::vector<uint16_t> oldest;
+};
+
+// Re-reference interval prediction (Jaleel et al., ISCA 2010) with
+// 2-bit re-reference prediction values (RRPVs). Hits set a line's RRPV
+// to 0, and the victim is the first line at 3, after aging the set
+// until there is one. Empty ways are kept at 3.
+// The RRPVs of a set are packed 32 to a word, so the victim search
+// compares every way of a word at once with a few bit operations.
+// The type of the config picks the insertion:
+//    Srrip  every line at 2
+//    Brrip  at 3, except every brripPeriod-th at 2
+//    Drrip  set dueling: leaderSets sets use each of the above, and
+//           PSEL counts their misses (up for SRRIP's, down for
+//           BRRIP's). The other sets use BRRIP while PSEL's top bit
+//           is set. Caches with fewer than 4 * leaderSets sets have a
+//           quarter of their sets lead each, so half still follow.
+//           There must be at least 4 sets
+class RripPolicy {
+public:
+   static constexpr uint32_t brripPeriod = 32;
+   static constexpr uint32_t leaderSets = 32;
+   static constexpr uint32_t pselBits = 10;
+   static constexpr uint32_t pselPeriod = 16384;
+
+   RripPolicy(uint64_t num_sets, unsigned int assoc, 
+              const ReplacementConfig& config = {}) : 
+               type(config.type), 
+               rrpv(num_sets * words(assoc))
+   {
+      assert(type == ReplacementType::Srrip || 
+             type == ReplacementType::Brrip ||
+             type == ReplacementType::Drrip || num_sets == 0);
+      for (uint64_t i = 0; i < rrpv.size(); ++i) {
+         rrpv[i] = 3 * laneMask(i % words(assoc), assoc);
+      }
+      if (type == ReplacementType::Drrip) {
+         stats.psel.resize(1);
+      }
+      assert(type != ReplacementType::Drrip || num_sets == 0 || num_sets >= 4);
+      // Spread the leaders over the sets, one of each per stride
+      uint64_t stride = std::max<uint64_t>(num_sets / leaderSets, 4);
+      leaderMask = stride - 1;
+      brripLeader = stride / 2;
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int assoc)
+   { rrpv[set * words(assoc) + way / 32] &= ~((uint64_t) 3 << laneShift(way)); }
+
+   // Ages the set so its highest RRPV is 3. If the way was empty it
+   // already was
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      uint64_t* set_rrpv = &rrpv[set * words(assoc)];
+      const unsigned int age = 3 - maxRrpv(set, assoc);
+      for (unsigned int w = 0; w < words(assoc); ++w) {
+         set_rrpv[w] += age * laneMask(w, assoc);
+      }
+
+      const uint64_t insert = insertion(set);
+      uint64_t& word = set_rrpv[way / 32];
+      word = (word & ~((uint64_t) 3 << laneShift(way))) | 
+             (insert << laneShift(way));
+      stats.rrpvInserts[insert]++;
+   }
+
+   void invalidate(uint64_t set, unsigned int way, unsigned int assoc)
+   { rrpv[set * words(assoc) + way / 32] |= (uint64_t) 3 << laneShift(way); }
+
+   unsigned int victim(uint64_t set, unsigned int assoc) const
+   {
+      const unsigned int max = maxRrpv(set, assoc);
+      const uint64_t* set_rrpv = &rrpv[set * words(assoc)];
+      for (unsigned int w = 0; w < words(assoc); ++w) {
+         uint64_t at_max = atLeast(set_rrpv[w], max) & laneMask(w, assoc);
+         if (at_max) {
+            return 32 * w + __builtin_ctzll(at_max) / 2;
+         }
+      }
+      return 0;
+   }
+
+   void prefetch(uint64_t set, unsigned int assoc) const
+   { __builtin_prefetch(&rrpv[set * words(assoc)]); }
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return stats; }
+private:
+   ReplacementType type;
+   std::vector<uint64_t> rrpv;
+   uint64_t leaderMask;
+   uint64_t brripLeader;
+   uint32_t psel{1 << (pselBits - 1)};
+   uint32_t brripFills{0};
+   uint32_t fills{0};
+   ReplacementStats stats;
+
+   static unsigned int words(unsigned int assoc) { return (assoc + 31) / 32; }
+   static unsigned int laneShift(unsigned int way) { return 2 * (way % 32); }
+   // The low bit of each RRPV of word w that holds a way
+   static uint64_t laneMask(unsigned int w, unsigned int assoc)
+   {
+      const unsigned int lanes = std::min(32u, assoc - 32 * w);
+      const uint64_t low_bits = 0x5555555555555555ULL;
+      return lanes == 32 ? low_bits : low_bits & (((uint64_t) 1 << (2 * lanes)) - 1);
+   }
+   // The low bit of each RRPV of word that is at least value
+   static uint64_t atLeast(uint64_t word, unsigned int value)
+   {
+      switch (value) {
+         case 3: return word & (word >> 1);
+         case 2: return word >> 1;
+         case 1: return word | (word >> 1);
+         default: return ~(uint64_t) 0;
+      }
+   }
+
+   unsigned int maxRrpv(uint64_t set, unsigned int assoc) const
+   {
+      const uint64_t* set_rrpv = &rrpv[set * words(assoc)];
+      for (unsigned int max = 3; max > 0; --max) {
+         for (unsigned int w = 0; w < words(assoc); ++w) {
+            if (atLeast(set_rrpv[w], max) & laneMask(w, assoc)) {
+               return max;
+            }
+         }
+      }
+      return 0;
+   }
+
+   // RRPV of a line filled into set, which missed
+   uint64_t insertion(uint64_t set)
+   {
+      bool brrip = type == ReplacementType::Brrip;
+      if (type == ReplacementType::Drrip) {
+         const uint32_t psel_max = (1 << pselBits) - 1;
+         const uint64_t leader = set & leaderMask;
+         if (leader == 0) {
+            psel = std::min(psel + 1, psel_max);
+         } else if (leader == brripLeader) {
+            psel = psel > 0 ? psel - 1 : 0;
+            brrip = true;
+         } else {
+            brrip = psel >> (pselBits - 1);
+         }
+         if (++fills == pselPeriod) {
+            fills = 0;
+            stats.psel[0].push_back(psel);
+         }
+      }
+
+      if (!brrip) {
+         return 2;
+      }
+      if (++brripFills == brripPeriod) {
+         brripFills = 0;
+         return 2;
+      }
+      return 3;
+   }
+};
+
+// Belady's optimal replacement (OPT/MIN): the victim is the line whose
+// next access is furthest in the future, or never comes. The future is
+// read from a NextUseIndex built in a first pass over the trace, and
+// the policy steps through it as it is told of each access, so every
+// access of the trace must reach the cache exactly once and in order,
+// as a hit or a fill. That rules out prefetches, sampling and
+// dividing the sets between caches. Lines are never bypassed, so this
+// is the optimal policy among those that fill every miss
+class OptPolicy {
+public:
+   OptPolicy(uint64_t num_sets, unsigned int assoc, 
+             const ReplacementConfig& config = {}) : 
+               index(config.nextUse), nextUse(num_sets * assoc, never) 
+   {
+      assert(index || num_sets == 0);
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int assoc)
+   { nextUse[set * assoc + way] = advance(); }
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   { nextUse[set * assoc + way] = advance(); }
+   void invalidate(uint64_t set, unsigned int way, unsigned int assoc)
+   { nextUse[set * assoc + way] = never; }
+
+   unsigned int victim(uint64_t set, unsigned int assoc) const
+   {
+      const uint64_t* set_next = &nextUse[set * assoc];
+      unsigned int furthest = 0;
+      for (unsigned int way = 1; way < assoc; ++way) {
+         if (set_next[way] > set_next[furthest]) {
+            furthest = way;
+         }
+      }
+      return furthest;
+   }
+
+   void prefetch(uint64_t set, unsigned int assoc) const
+   { __builtin_prefetch(&nextUse[set * assoc]); }
+
+   bool tracksEmpty() const { return false; }
+   ReplacementStats getStats() const { return {}; }
+private:
+   static constexpr uint64_t never = ~((uint64_t) 0);
+   // Accesses between releases of the index's pages behind
+   static constexpr uint64_t releasePeriod = 1 << 20;
+
+   std::shared_ptr<NextUseIndex> index;
+   // Position in the trace of the next access to each way's line
+   std::vector<uint64_t> nextUse;
+   uint64_t position{0}; // Of the current access
+
+   // Next use of the line of the current access, which moves on to the
+   // next access
+   uint64_t advance()
+   {
+      assert(position < index->size());
+      const uint32_t distance = index->distance(position);
+      const uint64_t next = distance ? position + distance : never;
+      if (++position % releasePeriod == 0) {
+         index->release(position);
+      }
+      return next;
+   }
+};
+
+// Any of the policies above, chosen by the config's type at run time.
+// Used where specializing for each policy isn't worth the code size,
+// at the cost of a switch in every call. Only the chosen policy's
+// state is allocated. Opt is only simulated by single systems, which
+// specialize it
+class RuntimePolicy {
+public:
+   RuntimePolicy(uint64_t num_sets, unsigned int assoc, 
+                 const ReplacementConfig& config = {}) : 
+               type(config.type),
+               lru(type == ReplacementType::Lru ? num_sets : 0, assoc, config),
+               tree(type == ReplacementType::TreePlru ? num_sets : 0, 
+                    treeAssoc(assoc), config),
+               bit(type == ReplacementType::BitPlru ? num_sets : 0, 
+                   bitAssoc(assoc), config),
+               rrip(isRrip() ? num_sets : 0, assoc, config),
+               random(num_sets, assoc, config),
+               fifo(type == ReplacementType::Fifo ? num_sets : 0, assoc, config)
+   {
+      assert(type != ReplacementType::Opt);
+   }
+
+   void touch(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      switch (type) {
+         case ReplacementType::Lru: lru.touch(set, way, assoc); break;
+         case ReplacementType::TreePlru: tree.touch(set, way, assoc); break;
+         case ReplacementType::BitPlru: bit.touch(set, way, assoc); break;
+         case ReplacementType::Random: break;
+         case ReplacementType::Fifo: break;
+         default: rrip.touch(set, way, assoc); break;
+      }
+   }
+
+   void fill(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      switch (type) {
+         case ReplacementType::Lru: lru.fill(set, way, assoc); break;
+         case ReplacementType::TreePlru: tree.fill(set, way, assoc); break;
+         case ReplacementType::BitPlru: bit.fill(set, way, assoc); break;
+         case ReplacementType::Random: random.fill(set, way, assoc); break;
+         case ReplacementType::Fifo: fifo.fill(set, way, assoc); break;
+         default: rrip.fill(set, way, assoc); break;
+      }
+   }
+
+   void invalidate(uint64_t set, unsigned int way, unsigned int assoc)
+   {
+      switch (type) {
+         case ReplacementType::Lru: lru.invalidate(set, way, assoc); break;
+         case ReplacementType::TreePlru: tree.invalidate(set, way, assoc); break;
+         case ReplacementType::BitPlru: bit.invalidate(set, way, assoc); break;
+         case ReplacementType::Random: break;
+         case ReplacementType::Fifo: break;
+         default: rrip.invalidate(set, way, assoc); break;
+      }
+   }
+
+   unsigned int victim(uint64_t set, unsigned int assoc) const
+   {
+      switch (type) {
+         case ReplacementType::TreePlru: return tree.victim(set, assoc);
+         case ReplacementType::BitPlru: return bit.victim(set, assoc);
+         case ReplacementType::Lru: return lru.victim(set, assoc);
+         case ReplacementType::Random: return random.victim(set, assoc);
+         case ReplacementType::Fifo: return fifo.victim(set, assoc);
+         default: return rrip.victim(set, assoc);
+      }
+   }
+
+   void prefetch(uint64_t set, unsigned int assoc) const
+   {
+      switch (type) {
+         case ReplacementType::Lru: lru.prefetch(set, assoc); break;
+         case ReplacementType::TreePlru: tree.prefetch(set, assoc); break;
+         case ReplacementType::BitPlru: bit.prefetch(set, assoc); break;
+         case ReplacementType::Random: break;
+         case ReplacementType::Fifo: fifo.prefetch(set, assoc); break;
+         default: rrip.prefetch(set, assoc); break;
+      }
+   }
+
+   bool tracksEmpty() const { return type == ReplacementType::Lru; }
+   ReplacementStats getStats() const 
+   { return isRrip() ? rrip.getStats() : ReplacementStats(); }
+private:
+   ReplacementType type;
+   LruPolicy lru;
+   TreePlruPolicy tree;
+   BitPlruPolicy bit;
+   RripPolicy rrip;
+   RandomPolicy random;
+   FifoPolicy fifo;
+
+   bool isRrip() const 
+   { 
+      return type == ReplacementType::Srrip || type == ReplacementType::Brrip ||
+             type == ReplacementType::Drrip;
+   }
+
+   // The unused policies are built with no sets, and an associativity
+   // they accept
+   unsigned int treeAssoc(unsigned int assoc) const
+   { return type == ReplacementType::TreePlru ? assoc : 1; }
+   unsigned int bitAssoc(unsigned int assoc) const
+   { return type == ReplacementType::BitPlru ? assoc : 1; }
+};
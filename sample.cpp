@@ -0,0 +1,120 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "sample.h"
+
+// The geometry of the base is unused, the wrapped system simulates
+SampledSystem::SampledSystem(std::unique_ptr<System> sys, uint64_t interval,
+                             uint64_t warmup, uint64_t detail) :
+      System(64, 1, 1, nullptr), sys(std::move(sys)), interval(interval),
+      warmupStart(interval - warmup - detail), detailStart(interval - detail)
+{
+   assert(detail > 0 && detail <= interval && warmup <= interval - detail);
+}
+
+void SampledSystem::memAccess(uint64_t address, AccessType type, 
+                              unsigned int tid)
+{
+   memAccessBatch(&address, &type, &tid, 1);
+}
+
+void SampledSystem::memAccessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, size_t n)
+{
+   size_t i = 0;
+   while (i < n) {
+      uint64_t phase = position % interval;
+      uint64_t end;
+
+      if (phase < warmupStart) {
+         end = warmupStart;
+      } else {
+         if (phase == detailStart) {
+            sys->sync();
+            windowStart = sys->stats;
+         }
+         end = phase < detailStart ? detailStart : interval;
+      }
+
+      size_t len = std::min<uint64_t>(end - phase, n - i);
+      if (phase >= warmupStart) {
+         sys->memAccessBatch(addrs + i, types + i, tids + i, len);
+      } else {
+         sys->skipBatch(addrs + i, tids + i, len);
+      }
+      i += len;
+      position += len;
+
+      if (phase + len == interval) {
+         sys->sync();
+         SystemStats window = sys->stats;
+         window -= windowStart;
+         windows.push_back(window);
+      }
+   }
+}
+
+void SampledSystem::skipBatch(const uint64_t* addrs, const unsigned int* tids,
+                              size_t n)
+{
+   sys->skipBatch(addrs, tids, n);
+}
+
+void SampledSystem::sync()
+{
+   sys->sync();
+   stats = SystemStats();
+   for (const SystemStats& window : windows) {
+      stats += window;
+   }
+}
+
+SampleEstimate SampledSystem::estimate(uint64_t SystemStats::* field) const
+{
+   SampleEstimate result{0, std::numeric_limits<double>::infinity()};
+   if (windows.empty()) {
+      return result;
+   }
+
+   double sum = 0;
+   double squares = 0;
+   for (const SystemStats& window : windows) {
+      double rate = (double) (window.*field) / window.accesses;
+      sum += rate;
+      squares += rate * rate;
+   }
+
+   double n = windows.size();
+   result.mean = sum / n;
+   if (windows.size() > 1) {
+      // Normal approximation, as the number of windows is usually large
+      double variance = std::max(0.0, (squares - sum * result.mean) / (n - 1));
+      result.halfWidth = 1.96 * std::sqrt(variance / n);
+   }
+   return result;
+}
@@ -0,0 +1,76 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+#include "misc.h"
+#include "system.h"
+
+// Simulates periodic samples of a trace on another system, as in
+// SMARTS (Wunderlich et al., ISCA 2003). The trace is divided into
+// periods of interval accesses, and in each period only the last
+// warmup + detail accesses are simulated: the warmup accesses bring the
+// caches to a realistic state, and the stats of the detail window that
+// follows are measured. The other accesses are skipped, which is where
+// the time is saved, and with warmup = interval - detail every access
+// warms the caches. Skipped accesses still translate and place their
+// pages and mark their lines as seen (System::skipBatch), so compulsory
+// misses and the domains of pages are those of the whole trace.
+// The stats are the sum of the complete detail windows. The rates of
+// the whole trace are estimated from the rates of the windows, which
+// are taken as independent samples
+class SampledSystem final : public System {
+public:
+   SampledSystem(std::unique_ptr<System> sys, uint64_t interval, 
+                 uint64_t warmup, uint64_t detail);
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                  size_t n) override;
+   void sync() override;
+
+   const System& getSystem() const { return *sys; }
+   // Accesses passed in, simulated or not
+   uint64_t getTraceAccesses() const { return position; }
+   // Stats of each complete detail window
+   const std::vector<SystemStats>& getWindows() const { return windows; }
+   // Estimates field per access, e.g. the hit rate for &SystemStats::hits.
+   // The interval is infinite with fewer than two windows
+   SampleEstimate estimate(uint64_t SystemStats::* field) const;
+private:
+   std::unique_ptr<System> sys;
+   uint64_t interval;
+   // Positions in each period where the warmup and detail windows start
+   uint64_t warmupStart;
+   uint64_t detailStart;
+   uint64_t position{0};
+   // Stats of sys when the current detail window started
+   SystemStats windowStart;
+   std::vector<SystemStats> windows;
+};
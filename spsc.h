@@ -0,0 +1,181 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <cassert>
+#include <algorithm>
+
+// Bounded lock-free ring for passing objects from one producer thread
+// to one consumer thread. The objects are allocated once and reused:
+// the producer fills the slot returned by producerSlot and publishes it
+// with push, and the consumer reads consumerSlot and releases it with pop
+template <class T>
+class SpscRing {
+public:
+   // capacity must be a power of 2
+   template <class... Args>
+   explicit SpscRing(size_t capacity, const Args&... args) : 
+         mask(capacity - 1)
+   {
+      assert(capacity > 0 && (capacity & mask) == 0);
+      slots.reserve(capacity);
+      for (size_t i = 0; i < capacity; ++i) {
+         slots.emplace_back(args...);
+      }
+   }
+
+   // Returns the next free slot, or nullptr if the ring is full
+   T* producerSlot()
+   {
+      size_t tail = tailPos.load(std::memory_order_relaxed);
+      if (tail - headCache > mask) {
+         headCache = headPos.load(std::memory_order_acquire);
+         if (tail - headCache > mask) {
+            return nullptr;
+         }
+      }
+      return &slots[tail & mask];
+   }
+   void push()
+   {
+      tailPos.store(tailPos.load(std::memory_order_relaxed) + 1, 
+                    std::memory_order_release);
+   }
+
+   // Returns the oldest published slot, or nullptr if the ring is empty
+   T* consumerSlot()
+   {
+      size_t head = headPos.load(std::memory_order_relaxed);
+      if (head == tailCache) {
+         tailCache = tailPos.load(std::memory_order_acquire);
+         if (head == tailCache) {
+            return nullptr;
+         }
+      }
+      return &slots[head & mask];
+   }
+   void pop()
+   {
+      headPos.store(headPos.load(std::memory_order_relaxed) + 1, 
+                    std::memory_order_release);
+   }
+
+   // Called by the producer, true once the consumer has popped every
+   // slot pushed
+   bool drained() const
+   {
+      return headPos.load(std::memory_order_acquire) == 
+             tailPos.load(std::memory_order_relaxed);
+   }
+private:
+   std::vector<T> slots;
+   const size_t mask;
+
+   // The positions only increase, and are kept on separate cache lines
+   // with a cached copy of the other side's position, so each side
+   // only reads the other's line when it appears full or empty
+   alignas(64) std::atomic<size_t> tailPos{0};
+   size_t headCache{0}; // Producer's copy of headPos
+   alignas(64) std::atomic<size_t> headPos{0};
+   size_t tailCache{0}; // Consumer's copy of tailPos
+};
+
+// Bounded lock-free ring passing every object from one producer thread
+// to each of a fixed number of consumer threads. A slot is reused once
+// all of the consumers have popped it
+template <class T>
+class BroadcastRing {
+public:
+   // capacity must be a power of 2
+   template <class... Args>
+   BroadcastRing(size_t capacity, unsigned int num_consumers, 
+                 const Args&... args) : 
+         mask(capacity - 1), consumers(num_consumers)
+   {
+      assert(capacity > 0 && (capacity & mask) == 0);
+      slots.reserve(capacity);
+      for (size_t i = 0; i < capacity; ++i) {
+         slots.emplace_back(args...);
+      }
+   }
+
+   // Returns the next free slot, or nullptr if the ring is full
+   T* producerSlot()
+   {
+      size_t tail = tailPos.load(std::memory_order_relaxed);
+      if (tail - minHeadCache > mask) {
+         minHeadCache = tail;
+         for (Consumer& consumer : consumers) {
+            minHeadCache = std::min(minHeadCache, 
+                              consumer.headPos.load(std::memory_order_acquire));
+         }
+         if (tail - minHeadCache > mask) {
+            return nullptr;
+         }
+      }
+      return &slots[tail & mask];
+   }
+   void push()
+   {
+      tailPos.store(tailPos.load(std::memory_order_relaxed) + 1, 
+                    std::memory_order_release);
+   }
+
+   // Returns the oldest slot that consumer has not popped, or nullptr
+   // if there is none
+   T* consumerSlot(unsigned int consumer)
+   {
+      Consumer& c = consumers[consumer];
+      size_t head = c.headPos.load(std::memory_order_relaxed);
+      if (head == c.tailCache) {
+         c.tailCache = tailPos.load(std::memory_order_acquire);
+         if (head == c.tailCache) {
+            return nullptr;
+         }
+      }
+      return &slots[head & mask];
+   }
+   void pop(unsigned int consumer)
+   {
+      std::atomic<size_t>& head = consumers[consumer].headPos;
+      head.store(head.load(std::memory_order_relaxed) + 1, 
+                 std::memory_order_release);
+   }
+private:
+   // Padded so consumers don't share cache lines
+   struct Consumer {
+      std::atomic<size_t> headPos{0};
+      size_t tailCache{0}; // Consumer's copy of tailPos
+      char padding[64 - sizeof(std::atomic<size_t>) - sizeof(size_t)];
+   };
+
+   std::vector<T> slots;
+   const size_t mask;
+   alignas(64) std::atomic<size_t> tailPos{0};
+   size_t minHeadCache{0}; // Producer's copy of the slowest headPos
+   std::vector<Consumer> consumers;
+};
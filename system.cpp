@@ -24,6 +24,8 @@ freely, subject to the following restrictions:
 #include <cassert>
 #include <cmath>
 #include <cstdlib>
+#include <typeinfo>
+#include <algorithm>
 
 #include "misc.h"
 #include "cache.h"
@@ -33,17 +35,155 @@ System::System(
             unsigned int line_size, unsigned int num_lines, unsigned int assoc,
             std::unique_ptr<Prefetch> prefetcher, 
             bool count_compulsory /*=false*/,
-            bool do_addr_trans /*=false*/) :
+            bool do_addr_trans /*=false*/,
+            unsigned int set_sampling /*=1*/) :
             prefetcher(std::move(prefetcher)),
             countCompulsory(count_compulsory),
-            doAddrTrans(do_addr_trans)
+            doAddrTrans(do_addr_trans),
+            setSampling(set_sampling)
 {
    assert(num_lines % assoc == 0);
+   assert((set_sampling & (set_sampling - 1)) == 0);
+   assert(set_sampling <= num_lines / assoc);
 
    lineMask = ((uint64_t) line_size)-1;
    setShift = log2(line_size);
-   setMask = ((num_lines / assoc) - 1) << setShift;
+   uint64_t sets = num_lines / assoc;
+   setMask = (sets - 1) << setShift;
    tagMask = ~(setMask | lineMask);
+
+   if (set_sampling > 1) {
+      // The sets are sampled in groups of a page's worth, or fewer if
+      // there are not enough sets for that, every set_sampling'th group
+      // being simulated. The bits of the set above those of its group
+      // are all 0 in sampled sets, and are removed from cache indexes
+      sampleShift = log2(set_sampling);
+      uint32_t group_bits = std::min<uint32_t>(pageShift - setShift, 
+                                               log2(sets) - sampleShift);
+      groupMask = (1 << group_bits) - 1;
+      sampleMask = (((uint64_t) set_sampling - 1) << group_bits) << setShift;
+      setAccesses.resize(sets / set_sampling);
+      setHits.resize(sets / set_sampling);
+   }
+}
+
+SampleEstimate System::estimateHitRate() const
+{
+   SampleEstimate result{stats.accesses ? 
+         (double) stats.hits / stats.accesses : 0, 0};
+   if (setSampling == 1) {
+      return result;
+   }
+
+   // Variance of a ratio estimate from a sample of n of the groups of
+   // sets, with the finite population correction. The sets of a group
+   // hold neighbouring lines, so they are not independent samples
+   const size_t group_size = groupMask + 1;
+   double n = setAccesses.size() / group_size;
+   double mean_accesses = stats.accesses / n;
+   double squares = 0;
+   for (size_t group = 0; group < setAccesses.size(); group += group_size) {
+      uint64_t accesses = 0;
+      uint64_t hits = 0;
+      for (size_t i = group; i < group + group_size; ++i) {
+         accesses += setAccesses[i];
+         hits += setHits[i];
+      }
+      double residual = hits - result.mean * accesses;
+      squares += residual * residual;
+   }
+
+   if (n < 2 || stats.accesses == 0) {
+      result.halfWidth = INFINITY;
+   } else {
+      double variance = (1 - 1.0 / setSampling) * squares / (n - 1) / 
+                        (n * mean_accesses * mean_accesses);
+      result.halfWidth = 1.96 * std::sqrt(variance);
+   }
+   return result;
+}
+
+AccessCounts& AccessCounts::operator+=(const AccessCounts& rhs)
+{
+   accesses += rhs.accesses;
+   hits += rhs.hits;
+   local_reads += rhs.local_reads;
+   remote_reads += rhs.remote_reads;
+   othercache_reads += rhs.othercache_reads;
+   local_writes += rhs.local_writes;
+   remote_writes += rhs.remote_writes;
+   compulsory += rhs.compulsory;
+   prefetched += rhs.prefetched;
+   return *this;
+}
+
+SystemStats& SystemStats::operator+=(const SystemStats& rhs)
+{
+   AccessCounts::operator+=(rhs);
+   replacement += rhs.replacement;
+   return *this;
+}
+
+SystemStats SystemStats::scaled(double factor) const
+{
+   SystemStats result;
+   result.accesses = llround(accesses * factor);
+   result.hits = llround(hits * factor);
+   result.local_reads = llround(local_reads * factor);
+   result.remote_reads = llround(remote_reads * factor);
+   result.othercache_reads = llround(othercache_reads * factor);
+   result.local_writes = llround(local_writes * factor);
+   result.remote_writes = llround(remote_writes * factor);
+   result.compulsory = llround(compulsory * factor);
+   result.prefetched = llround(prefetched * factor);
+   for (unsigned int i = 0; i < 4; ++i) {
+      result.replacement.rrpvInserts[i] = 
+            llround(replacement.rrpvInserts[i] * factor);
+   }
+   result.replacement.psel = replacement.psel;
+   return result;
+}
+
+AccessCounts& AccessCounts::operator-=(const AccessCounts& rhs)
+{
+   accesses -= rhs.accesses;
+   hits -= rhs.hits;
+   local_reads -= rhs.local_reads;
+   remote_reads -= rhs.remote_reads;
+   othercache_reads -= rhs.othercache_reads;
+   local_writes -= rhs.local_writes;
+   remote_writes -= rhs.remote_writes;
+   compulsory -= rhs.compulsory;
+   prefetched -= rhs.prefetched;
+   return *this;
+}
+
+SystemStats& SystemStats::operator-=(const SystemStats& rhs)
+{
+   AccessCounts::operator-=(rhs);
+   replacement -= rhs.replacement;
+   return *this;
+}
+
+void System::memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                            const unsigned int* tids, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      memAccess(addrs[i], types[i], tids[i]);
+   }
+}
+
+void System::skipBatch(const uint64_t* addrs, const unsigned int*, size_t n)
+{
+   if (!doAddrTrans && !countCompulsory) {
+      return;
+   }
+   for (size_t i = 0; i < n; ++i) {
+      uint64_t address = doAddrTrans ? virtToPhys(addrs[i]) : addrs[i];
+      if (countCompulsory) {
+         seenLines.insert(address & ~lineMask);
+      }
+   }
 }
 
 void System::checkCompulsory(uint64_t line)
@@ -74,40 +214,45 @@ uint64_t System::virtToPhys(uint64_t address)
    return phys_addr;
 }
 
+// Searches every remote cache once, saving the results in remoteWays
+// so that processMOESI can change remote states without searching again
 unsigned int MultiCacheSystem::checkRemoteStates(uint64_t set, 
                uint64_t tag, CacheState& state, unsigned int local)
 {
    CacheState curState = CacheState::Invalid;
    state = CacheState::Invalid;
    unsigned int remote = 0;
+   bool found_owner = false;
 
    for(unsigned int i=0; i<caches.size(); ++i) {
       if(i == local) {
          continue;
       }
 
-      curState = caches[i]->findTag(set, tag);
+      remoteWays[i] = caches[i]->lookup(set, tag);
+      if (found_owner || !remoteWays[i].found()) {
+         continue;
+      }
+
+      curState = caches[i]->getState(remoteWays[i]);
       switch (curState)
       {
          case CacheState::Owned:
-            state = CacheState::Owned;
-            return i;
+         case CacheState::Exclusive:
+         case CacheState::Modified:
+            // Keep searching the remaining caches so that every
+            // remote way is known, but this cache is the source
+            state = curState;
+            remote = i;
+            found_owner = true;
             break;
          case CacheState::Shared:
             // A cache line in a shared state may be
             // in the owned state in a different cache
-            // so don't return i immdiately
+            // so don't stop immdiately
             state = CacheState::Shared;
             remote = i;
             break;
-         case CacheState::Exclusive:
-            state = CacheState::Exclusive;
-            return i;
-            break;
-         case CacheState::Modified:
-            state = CacheState::Modified;
-            return i;
-            break;
          default:
             break;
       }
@@ -116,6 +261,7 @@ unsigned int MultiCacheSystem::checkRemoteStates(uint64_t set,
    return remote;
 }
 
+// Used for write hits, when the remote caches have not been searched
 void MultiCacheSystem::setRemoteStates(uint64_t set, 
                uint64_t tag, CacheState state, unsigned int local)
 {
@@ -126,11 +272,22 @@ void MultiCacheSystem::setRemoteStates(uint64_t set,
    }
 }
 
+// Invalidates the remote copies found by the last checkRemoteStates
+void MultiCacheSystem::invalidateRemotes(unsigned int local)
+{
+   for(unsigned int i=0; i < caches.size(); ++i) {
+      if(i != local && remoteWays[i].found()) {
+         caches[i]->setState(remoteWays[i], CacheState::Invalid);
+      }
+   }
+}
+
 // Maintains the statistics for memory write-backs
 void MultiCacheSystem::evictTraffic(uint64_t set, 
-               uint64_t tag, unsigned int local)
+               uint64_t tag, unsigned int local, AccessCounts& st)
 {
-   uint64_t page = ((set << setShift) | tag) & pageMask;
+   uint64_t full_set = setOfIndex((set << shardShift) | shard);
+   uint64_t page = ((full_set << setShift) | tag) & pageMask;
 
 #ifdef DEBUG
    const auto it = pageList.find(page);
@@ -139,9 +296,9 @@ void MultiCacheSystem::evictTraffic(uint64_t set,
 
    unsigned int domain = pageToDomain[page];
    if(domain == local) {
-      stats.local_writes++;
+      st.local_writes++;
    } else {
-      stats.remote_writes++;
+      st.remote_writes++;
    }
 }
 
@@ -159,75 +316,76 @@ bool MultiCacheSystem::isLocal(uint64_t address, unsigned int local)
 }
 
 
-CacheState MultiCacheSystem::processMOESI(uint64_t set,
-                  uint64_t tag, CacheState remote_state, AccessType accessType, 
+CacheState MultiCacheSystem::processMOESI(CacheState remote_state, AccessType accessType, 
                   bool local_traffic, unsigned int local, 
-                  unsigned int remote)
+                  unsigned int remote, AccessCounts& st)
 {
    CacheState new_state = CacheState::Invalid;
    bool is_prefetch = (accessType == AccessType::Prefetch);
+   // Prefetches bring lines in the same way as reads
+   bool is_write = (accessType == AccessType::Write);
 
-   if (remote_state == CacheState::Invalid && accessType == AccessType::Read) {
+   if (remote_state == CacheState::Invalid && !is_write) {
       new_state = CacheState::Exclusive;
 
       if (local_traffic && !is_prefetch) {
-         stats.local_reads++;
+         st.local_reads++;
       } else if (!is_prefetch) {
-         stats.remote_reads++;
+         st.remote_reads++;
       }
    }
-   else if (remote_state == CacheState::Invalid && accessType == AccessType::Write) {
+   else if (remote_state == CacheState::Invalid && is_write) {
       new_state = CacheState::Modified;
 
       if (local_traffic && !is_prefetch) {
-         stats.local_reads++;
+         st.local_reads++;
       } else if (!is_prefetch) {
-         stats.remote_reads++;
+         st.remote_reads++;
       }
    }
-   else if (remote_state == CacheState::Shared && accessType == AccessType::Read) {
+   else if (remote_state == CacheState::Shared && !is_write) {
       new_state = CacheState::Shared;
 
       if (local_traffic && !is_prefetch) {
-         stats.local_reads++;
+         st.local_reads++;
       } else if (!is_prefetch) {
-         stats.remote_reads++;
+         st.remote_reads++;
       }
    }
-   else if (remote_state == CacheState::Shared && accessType == AccessType::Write) {
+   else if (remote_state == CacheState::Shared && is_write) {
       new_state = CacheState::Modified;
-      setRemoteStates(set, tag, CacheState::Invalid, local);
+      invalidateRemotes(local);
 
       if (!is_prefetch) {
-         stats.othercache_reads++;
+         st.othercache_reads++;
       }
    }
    else if ((remote_state == CacheState::Modified || 
-             remote_state == CacheState::Owned) && accessType == AccessType::Read) {
+             remote_state == CacheState::Owned) && !is_write) {
       new_state = CacheState::Shared;
-      caches[remote]->changeState(set, tag, CacheState::Owned);
+      caches[remote]->setState(remoteWays[remote], CacheState::Owned);
 
       if (!is_prefetch) {
-         stats.othercache_reads++;
+         st.othercache_reads++;
       }
    }
    else if ((remote_state == CacheState::Modified || 
              remote_state == CacheState::Owned || 
              remote_state == CacheState::Exclusive) 
-             && accessType == AccessType::Write) {
+             && is_write) {
       new_state = CacheState::Modified;
-      setRemoteStates(set, tag, CacheState::Invalid, local);
+      invalidateRemotes(local);
 
       if (!is_prefetch) {
-         stats.othercache_reads++;
+         st.othercache_reads++;
       }
    }
-   else if (remote_state == CacheState::Exclusive && accessType == AccessType::Read) {
+   else if (remote_state == CacheState::Exclusive && !is_write) {
       new_state = CacheState::Shared;
-      caches[remote]->changeState(set, tag, CacheState::Shared);
+      caches[remote]->setState(remoteWays[remote], CacheState::Shared);
 
       if (!is_prefetch) {
-         stats.othercache_reads++;
+         st.othercache_reads++;
       }
    }
 
@@ -241,39 +399,151 @@ CacheState MultiCacheSystem::processMOESI(uint64_t set,
 void MultiCacheSystem::memAccess(uint64_t address, AccessType accessType, 
       unsigned int tid)
 {
-   if (doAddrTrans) {
+   if (setSampling > 1) {
+      access<true, Prefetch>(address, accessType, tid, tidToDomain[tid], 
+                             *this, stats);
+   } else {
+      access<false, Prefetch>(address, accessType, tid, tidToDomain[tid], 
+                              *this, stats);
+   }
+}
+
+template <class Pf>
+void StaticMultiCacheSystem<Pf>::memAccess(uint64_t address, 
+      AccessType accessType, unsigned int tid)
+{
+   if (setSampling > 1) {
+      access<true, Pf>(address, accessType, tid, tidToDomain[tid], 
+                       *this, stats);
+   } else {
+      access<false, Pf>(address, accessType, tid, tidToDomain[tid], 
+                        *this, stats);
+   }
+}
+
+void MultiCacheSystem::memAccessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, size_t n)
+{
+   accessBatch<Prefetch>(addrs, types, tids, n, *this);
+}
+
+template <class Pf>
+void StaticMultiCacheSystem<Pf>::memAccessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, size_t n)
+{
+   accessBatch<Pf>(addrs, types, tids, n, *this);
+}
+
+void MultiCacheSystem::skipBatch(const uint64_t* addrs, 
+                                 const unsigned int* tids, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      uint64_t address = doAddrTrans ? virtToPhys(addrs[i]) : addrs[i];
+      updatePageToDomain(address, tidToDomain[tids[i]]);
+      if (countCompulsory) {
+         seenLines.insert(address & ~lineMask);
+      }
+   }
+}
+
+void MultiCacheSystem::sync()
+{
+   stats.replacement = ReplacementStats();
+   for (auto& cache : caches) {
+      stats.replacement.addCaches(cache->getReplacementStats());
+   }
+}
+
+void MultiCacheSystem::accessPlaced(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, 
+      const unsigned int* touch_domains, size_t n)
+{
+   AccessCounts counts;
+   for (size_t i = 0; i < n; ++i) {
+      access<false, void>(addrs[i], types[i], tids[i], touch_domains[i], 
+                          *this, counts);
+   }
+   stats += counts;
+}
+
+// Prefetches the set needed batchPrefetchDistance accesses ahead in
+// the cache of the accessing thread. Remote caches are only searched on
+// a miss, so prefetching them costs more than it saves. The stats are
+// kept in a local copy as in BasicSingleCacheSystem::memAccessBatch
+template <class Pf, class Sys>
+void MultiCacheSystem::accessBatch(const uint64_t* addrs, 
+      const AccessType* types, const unsigned int* tids, size_t n, Sys& self)
+{
+   const bool prefetch_sets = setBeforeTranslation();
+   const bool sampled = setSampling > 1;
+   AccessCounts counts;
+
+   for (size_t i = 0; i < n; ++i) {
+      if (prefetch_sets && i + batchPrefetchDistance < n) {
+         const size_t ahead = i + batchPrefetchDistance;
+         caches[tidToDomain[tids[ahead]]]->prefetchSet(
+               cacheSet(addrs[ahead]));
+      }
+
+      if (sampled) {
+         access<true, Pf>(addrs[i], types[i], tids[i], 
+                          tidToDomain[tids[i]], self, counts);
+      } else {
+         access<false, Pf>(addrs[i], types[i], tids[i], 
+                           tidToDomain[tids[i]], self, counts);
+      }
+   }
+
+   stats += counts;
+}
+
+template <bool Sampled, class Pf, class Sys>
+void MultiCacheSystem::access(uint64_t address, AccessType accessType, 
+      unsigned int tid, unsigned int touch_domain, Sys& self, 
+      AccessCounts& st)
+{
+   if (Sampled) {
+      if (!sampleAndTranslate(address)) {
+         return;
+      }
+   } else if (doAddrTrans) {
       address = virtToPhys(address);
    }
 
    if (accessType != AccessType::Prefetch) {
-      stats.accesses++;
+      st.accesses++;
    }
 
    unsigned int local = tidToDomain[tid];
-   updatePageToDomain(address, local);
+   updatePageToDomain(address, touch_domain);
 
-   uint64_t set = (address & setMask) >> setShift;
+   uint64_t set = Sampled ? cacheSet(address) : 
+         (address & setMask) >> (setShift + shardShift);
    uint64_t tag = address & tagMask;
-   CacheState state = caches[local]->findTag(set, tag);
-   bool hit = (state != CacheState::Invalid);
+   CacheWay way = caches[local]->lookup(set, tag);
+   bool hit = way.found();
 
+   if (Sampled && accessType != AccessType::Prefetch) {
+      countSampled(set, hit);
+   }
    if (countCompulsory && accessType != AccessType::Prefetch) {
       checkCompulsory(address & (~lineMask));
    }
 
    // Handle hits 
    if (accessType == AccessType::Write && hit) { 
-      caches[local]->changeState(set, tag, CacheState::Modified);
+      caches[local]->setState(way, CacheState::Modified);
       setRemoteStates(set, tag, CacheState::Invalid, local);
    }
 
    if (hit) {
-      caches[local]->updateLRU(set, tag);
+      caches[local]->touch(way);
 
       if (accessType != AccessType::Prefetch) {
-         stats.hits++;
+         st.hits++;
          if (prefetcher) {
-            stats.prefetched += prefetcher->prefetchHit(address, tid, *this);
+            st.prefetched += PrefetchCall<Pf>::hit(prefetcher.get(), 
+                                                address, tid, self);
          }
       }
    }
@@ -283,20 +553,22 @@ void MultiCacheSystem::memAccess(uint64_t address, AccessType accessType,
       CacheState remote_state;
       unsigned int remote = checkRemoteStates(set, tag, remote_state, local);
 
-      uint64_t evicted_tag;
-      bool writeback = caches[local]->checkWriteback(set, evicted_tag);
+      CacheWay victim = caches[local]->victim(set);
+      CacheState victim_state = caches[local]->getState(victim);
       // TODO both evictTraffic and isLocal search the the pageToDomain map
-      if (writeback) {
-         evictTraffic(set, evicted_tag, local);
+      if (victim_state == CacheState::Modified || 
+          victim_state == CacheState::Owned) {
+         evictTraffic(set, caches[local]->getTag(victim), local, st);
       }
 
       bool local_traffic = isLocal(address, local);
-      CacheState new_state = processMOESI(set, tag, remote_state, accessType, 
-                                 local_traffic, local, remote);
-      caches[local]->insertLine(set, tag, new_state);
+      CacheState new_state = processMOESI(remote_state, accessType, 
+                                 local_traffic, local, remote, st);
+      caches[local]->replace(victim, tag, new_state);
 
-      if (accessType == AccessType::Prefetch && prefetcher) {
-         stats.prefetched += prefetcher->prefetchMiss(address, tid, *this);
+      if (accessType != AccessType::Prefetch && prefetcher) {
+         st.prefetched += PrefetchCall<Pf>::miss(prefetcher.get(), 
+                                                address, tid, self);
       }
    }
 }
@@ -317,51 +589,237 @@ void MultiCacheSystem::updatePageToDomain(uint64_t address,
 MultiCacheSystem::MultiCacheSystem(std::vector<unsigned int>& tid_to_domain, 
             unsigned int line_size, unsigned int num_lines, unsigned int assoc,
             std::unique_ptr<Prefetch> prefetcher, bool count_compulsory /*=false*/,
-            bool do_addr_trans /*=false*/, unsigned int num_domains) : 
+            bool do_addr_trans /*=false*/, unsigned int num_domains /*=1*/,
+            unsigned int set_sampling /*=1*/, 
+            const ReplacementConfig& replacement /*={}*/) : 
             System(line_size, num_lines, assoc, std::move(prefetcher), 
-                     count_compulsory, do_addr_trans),
+                     count_compulsory, do_addr_trans, set_sampling),
             tidToDomain(tid_to_domain)
 {
    caches.reserve(num_domains);
+   remoteWays.resize(num_domains);
 
+   ReplacementConfig cache_replacement = replacement;
    for (unsigned int i=0; i<num_domains; ++i) {
-      caches.push_back(std::make_unique<Cache>(num_lines, assoc));
+      cache_replacement.stream = i;
+      caches.push_back(std::make_unique<RuntimeCache>(num_lines / set_sampling, 
+                                                      assoc, cache_replacement));
    }
 }
 
-void SingleCacheSystem::memAccess(uint64_t address, AccessType accessType, unsigned int tid)
+MultiCacheSystem::MultiCacheSystem(std::vector<unsigned int>& tid_to_domain, 
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            bool count_compulsory, unsigned int num_domains, 
+            unsigned int shards, unsigned int shard,
+            const ReplacementConfig& replacement) : 
+            System(line_size, num_lines, assoc, nullptr, count_compulsory, false),
+            tidToDomain(tid_to_domain)
 {
-   bool is_prefetch = (accessType == AccessType::Prefetch);
+   assert((shards & (shards - 1)) == 0 && shard < shards);
+   shardShift = __builtin_ctz(shards);
+   this->shard = shard;
 
-   if (doAddrTrans) {
-      address = virtToPhys(address);
+   caches.reserve(num_domains);
+   remoteWays.resize(num_domains);
+
+   ReplacementConfig cache_replacement = replacement;
+   for (unsigned int i=0; i<num_domains; ++i) {
+      cache_replacement.stream = i;
+      caches.push_back(std::make_unique<RuntimeCache>(num_lines / shards, assoc,
+                                                      cache_replacement));
+   }
+}
+
+std::unique_ptr<System> makeMultiCacheSystem(
+            std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            std::unique_ptr<Prefetch> prefetcher, bool count_compulsory /*=false*/,
+            bool do_addr_trans /*=false*/, unsigned int num_domains /*=1*/,
+            unsigned int set_sampling /*=1*/, 
+            const ReplacementConfig& replacement /*={}*/)
+{
+   Prefetch* pf = prefetcher.get();
+
+   if (!pf) {
+      return std::make_unique<StaticMultiCacheSystem<void>>(tid_to_domain,
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, num_domains, set_sampling,
+                  replacement);
+   } else if (typeid(*pf) == typeid(SeqPrefetch)) {
+      return std::make_unique<StaticMultiCacheSystem<SeqPrefetch>>(tid_to_domain,
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, num_domains, set_sampling,
+                  replacement);
+   } else if (typeid(*pf) == typeid(AdjPrefetch)) {
+      return std::make_unique<StaticMultiCacheSystem<AdjPrefetch>>(tid_to_domain,
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, num_domains, set_sampling,
+                  replacement);
+   }
+
+   return std::make_unique<MultiCacheSystem>(tid_to_domain, line_size, 
+                  num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, num_domains, set_sampling,
+                  replacement);
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+void BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::memAccess(uint64_t address, 
+      AccessType accessType, unsigned int tid)
+{
+   accessOne(address, accessType, tid, *this);
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+void StaticSingleCacheSystem<Ways, LineSize, Pf, Policy>::memAccess(
+      uint64_t address, AccessType accessType, unsigned int tid)
+{
+   this->accessOne(address, accessType, tid, *this);
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+void BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::memAccessBatch(
+      const uint64_t* addrs, const AccessType* types, 
+      const unsigned int* tids, size_t n)
+{
+   accessBatch(addrs, types, tids, n, *this);
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+void StaticSingleCacheSystem<Ways, LineSize, Pf, Policy>::memAccessBatch(
+      const uint64_t* addrs, const AccessType* types, 
+      const unsigned int* tids, size_t n)
+{
+   this->accessBatch(addrs, types, tids, n, *this);
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+template <class Sys>
+void BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::accessOne(
+      uint64_t address, AccessType accessType, unsigned int tid, Sys& self)
+{
+   // Constant when the line size is fixed
+   const uint32_t line_shift = LineSize ? __builtin_ctz(LineSize) : setShift;
+
+   if (!sampleAndTranslate(address)) {
+      return;
+   }
+
+   if (setSampling > 1) {
+      access<true>(address, cacheIndex((address & setMask) >> line_shift), 
+                   address & tagMask, accessType, tid, stats, self);
+   } else {
+      access<false>(address, (address & setMask) >> line_shift, 
+                    address & tagMask, accessType, tid, stats, self);
    }
+}
+
+// Sets and tags are computed a block at a time ahead of the accesses,
+// and the stats are kept in a local copy so they can stay in registers
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+template <class Sys>
+void BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::accessBatch(
+      const uint64_t* addrs, const AccessType* types, 
+      const unsigned int* tids, size_t n, Sys& self)
+{
+   constexpr size_t block_size = 256;
+   const uint32_t line_shift = LineSize ? __builtin_ctz(LineSize) : setShift;
+   uint64_t sets[block_size];
+   uint64_t tags[block_size];
+   AccessCounts local;
+
+   if (doAddrTrans || setSampling > 1) {
+      // Translation has to happen in order with the prefetcher's
+      // accesses, so sets can't be computed ahead of time. Set sampling
+      // takes this path too, to keep the common one short
+      const bool prefetch_sets = setBeforeTranslation();
+      for (size_t i = 0; i < n; ++i) {
+         if (prefetch_sets && i + batchPrefetchDistance < n) {
+            cache->prefetchSet(cacheIndex(
+                  (addrs[i + batchPrefetchDistance] & setMask) >> line_shift));
+         }
+
+         uint64_t address = addrs[i];
+         if (!sampleAndTranslate(address)) {
+            continue;
+         }
+         if (setSampling > 1) {
+            access<true>(address, cacheIndex((address & setMask) >> line_shift), 
+                         address & tagMask, types[i], tids[i], local, self);
+         } else {
+            access<false>(address, (address & setMask) >> line_shift, 
+                          address & tagMask, types[i], tids[i], local, self);
+         }
+      }
+
+      stats += local;
+      return;
+   }
+
+   for (size_t start = 0; start < n; start += block_size) {
+      const size_t len = std::min(block_size, n - start);
+      const uint64_t* block_addrs = addrs + start;
+
+      // Without set sampling, sets are their own cache indexes
+      for (size_t i = 0; i < len; ++i) {
+         sets[i] = (block_addrs[i] & setMask) >> line_shift;
+         tags[i] = block_addrs[i] & tagMask;
+      }
+
+      for (size_t i = 0; i < len; ++i) {
+         if (i + batchPrefetchDistance < len) {
+            cache->prefetchSet(sets[i + batchPrefetchDistance]);
+         } else if (start + i + batchPrefetchDistance < n) {
+            cache->prefetchSet((addrs[start + i + batchPrefetchDistance] & setMask) 
+                                 >> line_shift);
+         }
+
+         access<false>(block_addrs[i], sets[i], tags[i], types[start + i], 
+                tids[start + i], local, self);
+      }
+   }
+
+   stats += local;
+}
+
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+template <bool Sampled, class Sys>
+void BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::access(uint64_t address, 
+      uint64_t set, uint64_t tag, AccessType accessType, unsigned int tid,
+      AccessCounts& st, Sys& self)
+{
+   // Constant when the line size is fixed
+   const uint64_t line_mask = LineSize ? LineSize - 1 : lineMask;
+
+   bool is_prefetch = (accessType == AccessType::Prefetch);
 
    if (!is_prefetch) {
-      stats.accesses++;
+      st.accesses++;
    }
 
-   uint64_t set = (address & setMask) >> setShift;
-   uint64_t tag = address & tagMask;
-   CacheState state = cache->findTag(set, tag);
-   bool hit = (state != CacheState::Invalid);
+   CacheWay way = cache->lookup(set, tag);
+   bool hit = way.found();
 
+   if (Sampled && !is_prefetch) {
+      countSampled(set, hit);
+   }
    if (countCompulsory && !is_prefetch) {
-      checkCompulsory(address & ~lineMask);
+      checkCompulsory(address & ~line_mask);
    }
 
    // Handle hits 
    if (accessType == AccessType::Write && hit) {  
-      cache->changeState(set, tag, CacheState::Modified);
+      cache->setState(way, CacheState::Modified);
    }
 
    if (hit) {
-      cache->updateLRU(set, tag);
+      cache->touch(way);
 
       if (!is_prefetch) {
-         stats.hits++;
+         st.hits++;
          if (prefetcher) {
-            stats.prefetched += prefetcher->prefetchHit(address, tid, *this);
+            st.prefetched += PrefetchCall<Pf>::hit(prefetcher.get(), 
+                                                address, tid, self);
          }
       }
 
@@ -369,11 +827,12 @@ void SingleCacheSystem::memAccess(uint64_t address, AccessType accessType, unsig
    }
 
    CacheState new_state = CacheState::Invalid;
-   uint64_t evicted_tag;
-   bool writeback = cache->checkWriteback(set, evicted_tag);
+   CacheWay victim = cache->victim(set);
+   CacheState victim_state = cache->getState(victim);
 
-   if (writeback) {
-      stats.local_writes++;
+   if (victim_state == CacheState::Modified || 
+       victim_state == CacheState::Owned) {
+      st.local_writes++;
    }
 
    if (accessType == AccessType::Read) {
@@ -383,21 +842,300 @@ void SingleCacheSystem::memAccess(uint64_t address, AccessType accessType, unsig
    }
 
    if (!is_prefetch) {
-      stats.local_reads++;
+      st.local_reads++;
    }
 
-   cache->insertLine(set, tag, new_state);
+   cache->replace(victim, tag, new_state);
    if (!is_prefetch && prefetcher) {
-      stats.prefetched += prefetcher->prefetchMiss(address, tid, *this);
+      st.prefetched += PrefetchCall<Pf>::miss(prefetcher.get(), 
+                                             address, tid, self);
    }
 }
 
-SingleCacheSystem::SingleCacheSystem( 
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::BasicSingleCacheSystem( 
             unsigned int line_size, unsigned int num_lines, unsigned int assoc,
             std::unique_ptr<Prefetch> prefetcher, 
             bool count_compulsory /*=false*/,
-            bool do_addr_trans /*=false*/) : 
-            System(line_size, num_lines, assoc,
-               std::move(prefetcher), count_compulsory, do_addr_trans), 
-            cache(std::make_unique<Cache>(num_lines, assoc))
-{}
+            bool do_addr_trans /*=false*/, 
+            unsigned int set_sampling /*=1*/, 
+            const ReplacementConfig& replacement /*={}*/) : 
+            System(line_size, num_lines, assoc, std::move(prefetcher), 
+               count_compulsory, do_addr_trans, set_sampling), 
+            cache(std::make_unique<BasicCache<Ways, Policy>>(
+                     num_lines / set_sampling, assoc, replacement))
+{
+   assert(LineSize == 0 || LineSize == line_size);
+}
+
+template class BasicSingleCacheSystem<0, 0>;
+
+// Picks the system matching the prefetcher's type
+template <unsigned int Ways, unsigned int LineSize, class Policy>
+static std::unique_ptr<System> makeForPrefetcher(unsigned int line_size, 
+               unsigned int num_lines, unsigned int assoc,
+               std::unique_ptr<Prefetch> prefetcher, bool count_compulsory, 
+               bool do_addr_trans, unsigned int set_sampling,
+               const ReplacementConfig& replacement)
+{
+   Prefetch* pf = prefetcher.get();
+
+   if (!pf) {
+      return std::make_unique<StaticSingleCacheSystem<Ways, LineSize, void, 
+                                                     Policy>>(
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, set_sampling, replacement);
+   } else if (typeid(*pf) == typeid(SeqPrefetch)) {
+      return std::make_unique<StaticSingleCacheSystem<Ways, LineSize, SeqPrefetch,
+                                                     Policy>>(
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, set_sampling, replacement);
+   } else if (typeid(*pf) == typeid(AdjPrefetch)) {
+      return std::make_unique<StaticSingleCacheSystem<Ways, LineSize, AdjPrefetch,
+                                                     Policy>>(
+                  line_size, num_lines, assoc, std::move(prefetcher), 
+                  count_compulsory, do_addr_trans, set_sampling, replacement);
+   }
+
+   return std::make_unique<StaticSingleCacheSystem<Ways, LineSize, Prefetch, 
+                                                  Policy>>(
+               line_size, num_lines, assoc, std::move(prefetcher), 
+               count_compulsory, do_addr_trans, set_sampling, replacement);
+}
+
+// Picks the system matching the replacement policy
+template <unsigned int Ways, unsigned int LineSize>
+static std::unique_ptr<System> makeForPolicy(unsigned int line_size, 
+               unsigned int num_lines, unsigned int assoc,
+               std::unique_ptr<Prefetch> prefetcher, bool count_compulsory, 
+               bool do_addr_trans, unsigned int set_sampling,
+               const ReplacementConfig& replacement)
+{
+   switch (replacement.type) {
+      case ReplacementType::Opt:
+         // Never has a prefetcher, see OptPolicy
+         assert(!prefetcher);
+         return std::make_unique<StaticSingleCacheSystem<Ways, LineSize, void, 
+                                                        OptPolicy>>(
+                     line_size, num_lines, assoc, std::move(prefetcher), 
+                     count_compulsory, do_addr_trans, set_sampling, replacement);
+      case ReplacementType::Srrip:
+      case ReplacementType::Brrip:
+      case ReplacementType::Drrip:
+         return makeForPrefetcher<Ways, LineSize, RripPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+      case ReplacementType::TreePlru:
+         return makeForPrefetcher<Ways, LineSize, TreePlruPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+      case ReplacementType::BitPlru:
+         return makeForPrefetcher<Ways, LineSize, BitPlruPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+      case ReplacementType::Random:
+         return makeForPrefetcher<Ways, LineSize, RandomPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+      case ReplacementType::Fifo:
+         return makeForPrefetcher<Ways, LineSize, FifoPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+      default:
+         return makeForPrefetcher<Ways, LineSize, LruPolicy>(line_size, 
+                     num_lines, assoc, std::move(prefetcher), count_compulsory,
+                     do_addr_trans, set_sampling, replacement);
+   }
+}
+
+std::unique_ptr<System> makeSingleCacheSystem(unsigned int line_size, 
+               unsigned int num_lines, unsigned int assoc,
+               std::unique_ptr<Prefetch> prefetcher, 
+               bool count_compulsory /*=false*/, 
+               bool do_addr_trans /*=false*/, unsigned int set_sampling /*=1*/,
+               const ReplacementConfig& replacement /*={}*/)
+{
+   if (line_size == 64) {
+      switch (assoc) {
+         case 4:
+            return makeForPolicy<4, 64>(line_size, num_lines, assoc, 
+                        std::move(prefetcher), count_compulsory, do_addr_trans, 
+                        set_sampling, replacement);
+         case 8:
+            return makeForPolicy<8, 64>(line_size, num_lines, assoc, 
+                        std::move(prefetcher), count_compulsory, do_addr_trans, 
+                        set_sampling, replacement);
+         case 16:
+            return makeForPolicy<16, 64>(line_size, num_lines, assoc, 
+                        std::move(prefetcher), count_compulsory, do_addr_trans, 
+                        set_sampling, replacement);
+         case 32:
+            return makeForPolicy<32, 64>(line_size, num_lines, assoc, 
+                        std::move(prefetcher), count_compulsory, do_addr_trans, 
+                        set_sampling, replacement);
+         case 64:
+            return makeForPolicy<64, 64>(line_size, num_lines, assoc, 
+                        std::move(prefetcher), count_compulsory, do_addr_trans, 
+                        set_sampling, replacement);
+         default:
+            break;
+      }
+   }
+
+   return makeForPolicy<0, 0>(line_size, num_lines, assoc, 
+               std::move(prefetcher), count_compulsory, do_addr_trans, 
+               set_sampling, replacement);
+}
+
+constexpr uint64_t StackDistanceSystem::noLine;
+
+StackDistanceSystem::StackDistanceSystem(unsigned int line_size, 
+            unsigned int num_sets, unsigned int max_assoc, 
+            bool count_compulsory /*=false*/, bool do_addr_trans /*=false*/) :
+            System(line_size, num_sets * max_assoc, max_assoc, nullptr, 
+                   count_compulsory, do_addr_trans),
+            maxAssoc(max_assoc), capacity(2 * max_assoc),
+            marks((uint64_t) num_sets * capacity, 0), 
+            lines((uint64_t) num_sets * capacity, noLine),
+            times(num_sets, 0), live(num_sets, 0), histogram(max_assoc + 1, 0)
+{
+   assert(max_assoc > 0);
+   lastUse.reserve((uint64_t) num_sets * max_assoc);
+}
+
+// Fenwick tree operations on the marks of a set, with times numbered
+// from 1
+static void addMark(uint32_t* tree, uint32_t capacity, uint32_t time, 
+                    int32_t delta)
+{
+   for (; time <= capacity; time += time & -time) {
+      tree[time - 1] += delta;
+   }
+}
+
+// Number of marks at times 1 to time
+static uint32_t countMarks(const uint32_t* tree, uint32_t time)
+{
+   uint32_t count = 0;
+   for (; time > 0; time -= time & -time) {
+      count += tree[time - 1];
+   }
+   return count;
+}
+
+void StackDistanceSystem::compact(uint64_t set)
+{
+   uint64_t* set_lines = &lines[set * capacity];
+   uint32_t* tree = &marks[set * capacity];
+
+   // Lines older than the newest maxAssoc miss at any associativity,
+   // however deep they are
+   uint32_t kept = 0;
+   uint32_t first = capacity;
+   for (uint32_t t = capacity; t-- > 0; ) {
+      if (set_lines[t] == noLine) {
+         continue;
+      }
+      if (kept < maxAssoc) {
+         ++kept;
+         first = t;
+      } else {
+         lastUse.erase(set_lines[t]);
+         set_lines[t] = noLine;
+      }
+   }
+
+   uint32_t next = 0;
+   for (uint32_t t = first; t < capacity; ++t) {
+      if (set_lines[t] != noLine) {
+         uint64_t line = set_lines[t];
+         set_lines[t] = noLine;
+         set_lines[next] = line;
+         lastUse[line] = next++;
+      }
+   }
+
+   // Times 1 to kept are marked, so each node counts the part of its
+   // range up to kept
+   for (uint32_t i = 1; i <= capacity; ++i) {
+      uint32_t low = i & -i;
+      uint32_t start = i - low;
+      tree[i - 1] = kept > start ? std::min(kept - start, low) : 0;
+   }
+
+   times[set] = kept;
+   live[set] = kept;
+}
+
+void StackDistanceSystem::access(uint64_t address)
+{
+   uint64_t line = address & ~lineMask;
+   uint64_t set = (address & setMask) >> setShift;
+
+   stats.accesses++;
+   if (countCompulsory) {
+      checkCompulsory(line);
+   }
+
+   if (times[set] == capacity) {
+      compact(set);
+   }
+   uint32_t now = times[set]++;
+   uint32_t* tree = &marks[set * capacity];
+
+   auto it = lastUse.emplace(line, now);
+   uint32_t distance = maxAssoc;
+   if (!it.second) {
+      // Each line accessed since the last access has one mark after it
+      uint32_t last = it.first->second;
+      distance = std::min(live[set] - countMarks(tree, last + 1), maxAssoc);
+      addMark(tree, capacity, last + 1, -1);
+      lines[set * capacity + last] = noLine;
+      it.first->second = now;
+   } else {
+      live[set]++;
+   }
+   addMark(tree, capacity, now + 1, 1);
+   lines[set * capacity + now] = line;
+
+   histogram[distance]++;
+   if (distance < maxAssoc) {
+      stats.hits++;
+   } else {
+      stats.local_reads++;
+   }
+}
+
+void StackDistanceSystem::memAccess(uint64_t address, AccessType, unsigned int)
+{
+   access(doAddrTrans ? virtToPhys(address) : address);
+}
+
+void StackDistanceSystem::memAccessBatch(const uint64_t* addrs, 
+      const AccessType*, const unsigned int*, size_t n)
+{
+   for (size_t i = 0; i < n; ++i) {
+      access(doAddrTrans ? virtToPhys(addrs[i]) : addrs[i]);
+   }
+}
+
+uint64_t StackDistanceSystem::getHits(unsigned int assoc) const
+{
+   assert(assoc <= maxAssoc);
+   uint64_t hits = 0;
+   for (unsigned int d = 0; d < assoc; ++d) {
+      hits += histogram[d];
+   }
+   return hits;
+}
+
+std::vector<uint64_t> StackDistanceSystem::missCurve() const
+{
+   std::vector<uint64_t> misses(maxAssoc);
+   uint64_t hits = 0;
+   for (unsigned int assoc = 1; assoc <= maxAssoc; ++assoc) {
+      hits += histogram[assoc - 1];
+      misses[assoc - 1] = stats.accesses - hits;
+   }
+   return misses;
+}
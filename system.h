@@ -34,7 +34,10 @@ freely, subject to the following restrictions:
 #include "prefetch.h"
 
 // All stats exclude prefetcher activity (except prefetched)
-struct SystemStats {
+// The counts are kept separately from the rest of SystemStats so that
+// simulation loops can add to a local copy of them, which stays in
+// registers
+struct AccessCounts {
    uint64_t accesses{0}; // Number of user reads and writes
    uint64_t hits{0}; // Cache hits. Misses = accesses - hits
    uint64_t local_reads{0}; // Local node RAM reads. Note that write misses can cause RAM reads
@@ -44,6 +47,28 @@ struct SystemStats {
    uint64_t remote_writes{0};
    uint64_t compulsory{0}; // Compulsory misses, i.e. the first access to an address
    uint64_t prefetched{0};
+
+   AccessCounts& operator+=(const AccessCounts& rhs);
+   AccessCounts& operator-=(const AccessCounts& rhs);
+};
+
+struct SystemStats : AccessCounts {
+   // Stats of the replacement policy, updated by System::sync
+   ReplacementStats replacement;
+
+   using AccessCounts::operator+=;
+   SystemStats& operator+=(const SystemStats& rhs);
+   SystemStats& operator-=(const SystemStats& rhs);
+   // Every count multiplied by factor, rounded. The PSEL samples are
+   // copied
+   SystemStats scaled(double factor) const;
+};
+
+// An estimate of a per-access rate, with the half width of its 95%
+// confidence interval. halfWidth is infinite if it can't be estimated
+struct SampleEstimate {
+   double mean;
+   double halfWidth;
 };
 
 class System {
@@ -65,15 +90,81 @@ protected:
    uint64_t nextPage{0};
    bool countCompulsory;
    bool doAddrTrans;
+   // With set sampling, addresses with any of these set bits are in sets
+   // that are not simulated, see cacheIndex
+   uint64_t sampleMask{0};
+   uint64_t groupMask{0};
+   uint32_t sampleShift{0};
+   unsigned int setSampling;
+   // Accesses and hits of each sampled set, kept with set sampling
+   std::vector<uint64_t> setAccesses;
+   std::vector<uint64_t> setHits;
+
+   // How many accesses ahead memAccessBatch prefetches sets
+   static constexpr size_t batchPrefetchDistance = 8;
 
    uint64_t virtToPhys(uint64_t address);
    void checkCompulsory(uint64_t line);
+   // True if the set of an address can be computed before translating it
+   bool setBeforeTranslation() const 
+   { return !doAddrTrans || (setMask & pageMask) == 0; }
+   // Translates address if needed, and returns false if the access is
+   // in a set that is not sampled. Accesses that can be skipped before
+   // translation are, so they do no map work
+   bool sampleAndTranslate(uint64_t& address)
+   {
+      if ((address & sampleMask) && 
+          (!doAddrTrans || (sampleMask & pageMask) == 0)) {
+         return false;
+      }
+      if (doAddrTrans) {
+         address = virtToPhys(address);
+      }
+      return (address & sampleMask) == 0;
+   }
+   // Index in the caches of a set. With set sampling, the caches only
+   // hold the sampled sets, so the bits that are 0 in all of them are
+   // removed. setOfIndex is the inverse
+   uint64_t cacheIndex(uint64_t set) const
+   { return ((set >> sampleShift) & ~groupMask) | (set & groupMask); }
+   uint64_t setOfIndex(uint64_t index) const
+   { return ((index & ~groupMask) << sampleShift) | (index & groupMask); }
+   void countSampled(uint64_t set, bool hit)
+   {
+      setAccesses[set]++;
+      setHits[set] += hit;
+   }
 public:
    virtual ~System() = default;
+   // With set_sampling (a power of 2) above 1, only 1 in set_sampling
+   // sets are simulated. They are sampled in groups of a page's worth of
+   // consecutive sets, so the prefetchers see the same sequences of lines
+   // within a page. Prefetches into sets that are not sampled are
+   // dropped, but are still counted in stats.prefetched
    System(unsigned int line_size, unsigned int num_lines, unsigned int assoc,
           std::unique_ptr<Prefetch> prefetcher, bool count_compulsory=false, 
-          bool do_addr_trans=false);
+          bool do_addr_trans=false, unsigned int set_sampling=1);
    virtual void memAccess(uint64_t address, AccessType type, unsigned int tid) = 0;
+   // Equivalent to calling memAccess for each of the n accesses in order.
+   // Systems override this to overlap the memory accesses of consecutive
+   // simulated accesses and avoid a virtual call per access
+   virtual void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                               const unsigned int* tids, size_t n);
+   // Updates only the state that depends on every access of the trace
+   // for n accesses that are not simulated: page translations, the lines
+   // seen for compulsory misses and the first-touch placement of pages.
+   // Used for the accesses SampledSystem skips
+   virtual void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                          size_t n);
+   // Waits until every access passed in has been simulated and updates
+   // stats. Only needed by systems that simulate on other threads, or
+   // for the replacement policy's stats
+   virtual void sync() {}
+   unsigned int getSetSampling() const { return setSampling; }
+   // The hit rate of all sets estimated from the sampled ones as a
+   // ratio estimate, treating the groups of sets as a random sample.
+   // Exact without set sampling
+   SampleEstimate estimateHitRate() const;
    SystemStats stats;
 };
 
@@ -82,38 +173,214 @@ class MultiCacheSystem : public System {
 private:
    // Stores NUMA domain location of pages
    std::unordered_map<uint64_t, unsigned int> pageToDomain;
-   std::vector<std::unique_ptr<Cache>> caches;
-   std::vector<unsigned int>& tidToDomain;
+   std::vector<std::unique_ptr<RuntimeCache>> caches;
+   // Result of searching each remote cache in checkRemoteStates
+   std::vector<CacheWay> remoteWays;
+   // The caches hold the sets numbered shard modulo 1 << shardShift,
+   // see ParallelMultiCacheSystem. All of them unless sharded
+   uint32_t shardShift{0};
+   uint64_t shard{0};
 
    unsigned int checkRemoteStates(uint64_t set, uint64_t tag, 
                         CacheState& state, unsigned int local);
    void updatePageToDomain(uint64_t address, unsigned int curDomain);
    void setRemoteStates(uint64_t set, uint64_t tag, 
                         CacheState state, unsigned int local);
+   void invalidateRemotes(unsigned int local);
    void evictTraffic(uint64_t set, uint64_t tag, 
-                     unsigned int local);
+                     unsigned int local, AccessCounts& st);
    bool isLocal(uint64_t address, unsigned int local);
-   CacheState processMOESI(uint64_t set, uint64_t tag, 
-                  CacheState remote_state, AccessType accessType, 
-                  bool local_traffic, unsigned int local, unsigned int remote);
+   CacheState processMOESI(CacheState remote_state, AccessType accessType, 
+                  bool local_traffic, unsigned int local, unsigned int remote,
+                  AccessCounts& st);
+protected:
+   std::vector<unsigned int>& tidToDomain;
+
+   // Implements memAccess. Pf is passed to PrefetchCall, and self is
+   // the object as its most derived type so prefetches can call back
+   // into it directly. The page of the address is placed in
+   // touch_domain if this is its first access, which is the accessing
+   // thread's domain unless the accesses are not seen in trace order.
+   // Sampled is set if only some sets are simulated. The counts are
+   // added to st, which batches keep locally as SingleCacheSystem does
+   template <bool Sampled, class Pf, class Sys>
+   void access(uint64_t address, AccessType type, unsigned int tid, 
+               unsigned int touch_domain, Sys& self, AccessCounts& st);
+   template <class Pf, class Sys>
+   void accessBatch(const uint64_t* addrs, const AccessType* types,
+                    const unsigned int* tids, size_t n, Sys& self);
+   // For a system holding one of shards shards of the sets, which must
+   // be a power of 2
+   MultiCacheSystem(std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            bool count_compulsory, unsigned int num_domains, 
+            unsigned int shards, unsigned int shard,
+            const ReplacementConfig& replacement);
+
+   // Simulates accesses without a prefetcher, placing the page of each
+   // in the domain in touch_domains if it is new
+   void accessPlaced(const uint64_t* addrs, const AccessType* types,
+                     const unsigned int* tids, const unsigned int* touch_domains,
+                     size_t n);
+
+   // Set of an address in the caches
+   uint64_t cacheSet(uint64_t address) const
+   { return cacheIndex((address & setMask) >> setShift) >> shardShift; }
 public:
    MultiCacheSystem(std::vector<unsigned int>& tid_to_domain,
             unsigned int line_size, unsigned int num_lines, unsigned int assoc,
             std::unique_ptr<Prefetch> prefetcher, bool count_compulsory=false, 
-            bool do_addr_trans=false, unsigned int num_domains=1);
+            bool do_addr_trans=false, unsigned int num_domains=1, 
+            unsigned int set_sampling=1, 
+            const ReplacementConfig& replacement={});
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   void skipBatch(const uint64_t* addrs, const unsigned int* tids, 
+                  size_t n) override;
+   void sync() override;
+};
+
+// A MultiCacheSystem whose prefetcher type (see PrefetchCall) is known
+// at compile time, created by makeMultiCacheSystem
+template <class Pf>
+class StaticMultiCacheSystem final : public MultiCacheSystem {
+public:
+   using MultiCacheSystem::MultiCacheSystem;
 
    void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
 };
 
+// Creates a MultiCacheSystem that calls its prefetcher statically.
+// Takes the same parameters as the MultiCacheSystem constructor
+std::unique_ptr<System> makeMultiCacheSystem(
+            std::vector<unsigned int>& tid_to_domain,
+            unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+            std::unique_ptr<Prefetch> prefetcher, bool count_compulsory=false, 
+            bool do_addr_trans=false, unsigned int num_domains=1, 
+            unsigned int set_sampling=1, 
+            const ReplacementConfig& replacement={});
+
 // For a system containing a sinle cache
-// performs about 10% better than the MultiCache implementation
-class SingleCacheSystem : public System {
+// performs about 10% better than the MultiCache implementation.
+// Ways and LineSize fix the geometry at compile time when not 0, Pf is
+// the prefetcher's type (see PrefetchCall) and Policy the cache's
+// replacement policy, see makeSingleCacheSystem
+template <unsigned int Ways, unsigned int LineSize, class Pf = Prefetch,
+          class Policy = LruPolicy>
+class BasicSingleCacheSystem : public System {
+public:
+   BasicSingleCacheSystem(unsigned int line_size, unsigned int num_lines, 
+               unsigned int assoc, std::unique_ptr<Prefetch> prefetcher, 
+               bool count_compulsory=false, bool do_addr_trans=false, 
+               unsigned int set_sampling=1, 
+               const ReplacementConfig& replacement={});
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   void sync() override { stats.replacement = cache->getReplacementStats(); }
+protected:
+   // Implement memAccess and memAccessBatch. self is the object as its
+   // most derived type so prefetches can call back into it directly
+   template <class Sys>
+   void accessOne(uint64_t address, AccessType type, unsigned int tid, 
+                  Sys& self);
+   template <class Sys>
+   void accessBatch(const uint64_t* addrs, const AccessType* types,
+                    const unsigned int* tids, size_t n, Sys& self);
+private:
+   std::unique_ptr<BasicCache<Ways, Policy>> cache;
+
+   // Simulates an access to an already translated address, counting
+   // the stats in st. Sampled is set if only some sets are simulated
+   template <bool Sampled, class Sys>
+   void access(uint64_t address, uint64_t set, uint64_t tag, 
+               AccessType type, unsigned int tid, AccessCounts& st, 
+               Sys& self);
+};
+
+using SingleCacheSystem = BasicSingleCacheSystem<0, 0>;
+
+// A BasicSingleCacheSystem that can't be subclassed, so its prefetcher
+// calls back into it directly, created by makeSingleCacheSystem
+template <unsigned int Ways, unsigned int LineSize, class Pf, class Policy>
+class StaticSingleCacheSystem final : 
+      public BasicSingleCacheSystem<Ways, LineSize, Pf, Policy> {
 public:
-   SingleCacheSystem(unsigned int line_size, unsigned int num_lines, unsigned int assoc,
+   using BasicSingleCacheSystem<Ways, LineSize, Pf, Policy>::
+         BasicSingleCacheSystem;
+
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+};
+
+// Creates a SingleCacheSystem, specialized for the geometry if it is
+// one of the commonly simulated ones (64 byte lines and 4, 8, 16, 32
+// or 64 ways), and for the type of the prefetcher and the replacement
+// policy
+std::unique_ptr<System> makeSingleCacheSystem(unsigned int line_size, 
+               unsigned int num_lines, unsigned int assoc,
                std::unique_ptr<Prefetch> prefetcher, bool count_compulsory=false, 
+               bool do_addr_trans=false, unsigned int set_sampling=1,
+               const ReplacementConfig& replacement={});
+
+// Finds the LRU stack distance of each access to a cache with a fixed
+// number of sets, which gives the misses of an LRU cache with that many
+// sets for every associativity up to maxAssoc in one pass (Mattson et
+// al.). The distance of an access is the number of other lines of its
+// set accessed since the line's last access, and the access hits in a
+// cache with assoc ways if it is less than assoc.
+// Each set's stack is a Fenwick tree over the times of its recent
+// accesses, with a mark at the last access of each line, so a distance
+// is a prefix count. Lines that fall more than maxAssoc deep are
+// dropped, so the tree and lastUse stay small.
+// The stats are those of a cache with maxAssoc ways, counting only
+// accesses, hits, misses (as local reads) and compulsory misses. There
+// is no prefetcher, since what it fetches would depend on the hits of
+// one associativity
+class StackDistanceSystem final : public System {
+public:
+   StackDistanceSystem(unsigned int line_size, unsigned int num_sets, 
+               unsigned int max_assoc, bool count_compulsory=false, 
                bool do_addr_trans=false);
 
    void memAccess(uint64_t address, AccessType type, unsigned int tid) override;
+   void memAccessBatch(const uint64_t* addrs, const AccessType* types,
+                       const unsigned int* tids, size_t n) override;
+   // Hits of an LRU cache with assoc ways, up to maxAssoc
+   uint64_t getHits(unsigned int assoc) const;
+   // Misses of each associativity from 1 to maxAssoc, with those of
+   // assoc ways in element assoc - 1
+   std::vector<uint64_t> missCurve() const;
+   unsigned int getMaxAssoc() const { return maxAssoc; }
 private:
-   std::unique_ptr<Cache> cache;
+   // Marks stored in lines for times without a live line. Lines have
+   // their offset bits clear, so this is never a line
+   static constexpr uint64_t noLine = ~((uint64_t) 0);
+
+   unsigned int maxAssoc;
+   // Times per set before the set's stack is compacted
+   uint32_t capacity;
+   // Per set, with a stride of capacity: the Fenwick tree of the marks,
+   // and the line last accessed at each time, or noLine
+   std::vector<uint32_t> marks;
+   std::vector<uint64_t> lines;
+   // Next time of each set, and the number of marks in its tree
+   std::vector<uint32_t> times;
+   std::vector<uint32_t> live;
+   // Time of the last access to each line in its set's stack
+   std::unordered_map<uint64_t, uint32_t> lastUse;
+   // Accesses at each distance below maxAssoc, then those that miss at
+   // every associativity
+   std::vector<uint64_t> histogram;
+
+   void access(uint64_t address);
+   // Renumbers the newest maxAssoc lines of a full set from time 0 and
+   // drops the rest
+   void compact(uint64_t set);
 };
@@ -25,6 +25,7 @@ freely, subject to the following restrictions:
 #include <string>
 #include <random>
 #include <chrono>
+#include <array>
 
 #include "system.h"
 
@@ -37,12 +38,6 @@ void usage() {
         << " <# iterations> <distribution 'uniform'|'normal'> <distribution range>" << endl;
 }
 
-struct AccessData {
-   uint64_t address;
-   unsigned int tid;
-   AccessType accessType;
-};
-
 int main(int argc, char* argv[]) {
    if (argc != 10) {
       usage();
@@ -97,16 +92,19 @@ int main(int argc, char* argv[]) {
 
    unique_ptr<System> sys;
    if (num_caches == 1) {
-      sys = make_unique<SingleCacheSystem>(cache_line_size, cache_lines, way_count, 
+      sys = makeSingleCacheSystem(cache_line_size, cache_lines, way_count, 
                            std::move(prefetch), 
                            compulsory, false);
    } else {
-      sys = make_unique<MultiCacheSystem>(tid_map, cache_line_size, cache_lines, way_count, 
+      sys = makeMultiCacheSystem(tid_map, cache_line_size, cache_lines, way_count, 
                            std::move(prefetch), 
                            compulsory, false, num_caches);
    }
 
-   array<AccessData, 2000> access_buffer;
+   // Structure of arrays, as taken by memAccessBatch
+   array<uint64_t, 2000> addr_buffer;
+   array<AccessType, 2000> type_buffer;
+   array<unsigned int, 2000> tid_buffer;
    default_random_engine engine(0);
    uniform_int_distribution<unsigned int> tid_generator(0, num_threads);
    uniform_int_distribution<unsigned int> rw_generator(0, 1);
@@ -117,22 +115,21 @@ int main(int argc, char* argv[]) {
 
    for (unsigned int i=0; i<iterations; ++i) {
       for (int j=0; j<2000; ++j) {
-         access_buffer[j].accessType = rw_generator(engine) == 0 ? 
+         type_buffer[j] = rw_generator(engine) == 0 ? 
                                           AccessType::Read : 
                                           AccessType::Write;
-         access_buffer[j].tid = tid_generator(engine);
+         tid_buffer[j] = tid_generator(engine);
             if (distribution_choice == "uniform") {
-               access_buffer[j].address = addr_uniform(engine);
+               addr_buffer[j] = addr_uniform(engine);
             } else {
-               access_buffer[j].address = (uint64_t)addr_normal(engine);
+               addr_buffer[j] = (uint64_t)addr_normal(engine);
             }
-            access_buffer[j].address <<= 6;
+            addr_buffer[j] <<= 6;
       }
 
       auto start = chrono::high_resolution_clock::now();
-      for (int j=0; j<2000; ++j) {
-         sys->memAccess(access_buffer[j].address, access_buffer[j].accessType, access_buffer[j].tid);
-      }
+      sys->memAccessBatch(addr_buffer.data(), type_buffer.data(), 
+                          tid_buffer.data(), 2000);
       auto end = chrono::high_resolution_clock::now();
       run_time += chrono::duration_cast<chrono::duration<double>>(end - start);
    }
@@ -22,12 +22,58 @@ freely, subject to the following restrictions:
 */
 
 #include <iostream>
+#include <cstdio>
+#include <fstream>
+#include <cstddef>
+#include <map>
 
 #include "system.h"
+#include "trace.h"
+#include "pipeline.h"
+#include "config.h"
+#include "parallel.h"
+#include "sample.h"
 
 #define CATCH_CONFIG_MAIN
 #include "tests/catch.hpp"
 
+// Steps an LCG (Knuth's MMIX constants) and returns its new state, so
+// the random traces below are the same on every run
+static uint64_t nextRandom(uint64_t& state)
+{
+   state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+   return state;
+}
+
+// Sets addrs, types and tids to n random accesses to 64 byte lines of a
+// footprint of lines lines, a quarter of them writes, made by num_tids
+// threads in turn
+static void randomAccesses(uint64_t seed, size_t n, uint64_t lines, 
+                           unsigned int num_tids, std::vector<uint64_t>& addrs,
+                           std::vector<AccessType>& types, 
+                           std::vector<unsigned int>& tids)
+{
+   addrs.clear();
+   types.clear();
+   tids.clear();
+   uint64_t state = seed;
+   for (size_t i = 0; i < n; ++i) {
+      uint64_t r = nextRandom(state);
+      addrs.push_back(((r >> 24) % lines) << 6);
+      types.push_back((r >> 60) < 4 ? AccessType::Write : AccessType::Read);
+      tids.push_back(i % num_tids);
+   }
+}
+
+// Fills a 4-way set of cache with lines 1 to 4, in ways 0 to 3
+template <class C>
+static void fillSet(C& cache, uint64_t set)
+{
+   for (uint64_t line = 1; line <= 4; ++line) {
+      cache.replace(cache.victim(set), line << 12, CacheState::Exclusive);
+   }
+}
+
 TEST_CASE("Single cache tests", "[cache]") {
    unsigned int cache_line_size = 64;
    unsigned int cache_lines = 128;
@@ -125,3 +171,1065 @@ TEST_CASE("Single cache tests", "[cache]") {
       }
    }
 }
+
+TEST_CASE("Multi-cache prefetching", "[system]") {
+   // Demand misses and hits prefetch the next line, prefetches don't
+   // prefetch further, and prefetched lines are brought in like reads
+   // but not counted
+   std::vector<unsigned int> tid_map = {0, 1};
+   MultiCacheSystem multi(tid_map, 64, 128, 4, 
+                          std::make_unique<AdjPrefetch>(), false, false, 2);
+
+   // Miss, prefetching line 1
+   multi.memAccess(0 << 6, AccessType::Read, 0);
+   REQUIRE(multi.stats.prefetched == 1);
+   REQUIRE(multi.stats.local_reads == 1);
+   // Hit on the prefetched line, prefetching line 2
+   multi.memAccess(1 << 6, AccessType::Read, 0);
+   REQUIRE(multi.stats.hits == 1);
+   // Miss in the other cache, prefetching line 4 there
+   multi.memAccess(3 << 6, AccessType::Write, 1);
+   REQUIRE(multi.stats.remote_reads == 1);
+   // Hit, prefetching the line modified in the other cache
+   multi.memAccess(2 << 6, AccessType::Read, 0);
+   // Hit on the line shared by the prefetch, prefetching line 4 which
+   // the other cache has from its own prefetch
+   multi.memAccess(3 << 6, AccessType::Read, 0);
+
+   REQUIRE(multi.stats.accesses == 5);
+   REQUIRE(multi.stats.hits == 3);
+   REQUIRE(multi.stats.prefetched == 5);
+   REQUIRE(multi.stats.local_reads == 1);
+   REQUIRE(multi.stats.remote_reads == 1);
+   REQUIRE(multi.stats.othercache_reads == 0);
+   REQUIRE(multi.stats.local_writes == 0);
+   REQUIRE(multi.stats.remote_writes == 0);
+}
+
+TEST_CASE("Sequential prefetching", "[system]") {
+   // Two misses to consecutive lines prefetch the next three, then each
+   // hit on a prefetched line prefetches one more, so a stream of reads
+   // only misses on its first two lines
+   SingleCacheSystem single(64, 1024, 8, std::make_unique<SeqPrefetch>());
+   for (uint64_t line = 0; line < 32; ++line) {
+      single.memAccess(line << 6, AccessType::Read, 0);
+   }
+
+   REQUIRE(single.stats.accesses == 32);
+   REQUIRE(single.stats.hits == 30);
+}
+
+TEST_CASE("Batched accesses", "[system]") {
+   std::vector<unsigned int> tid_map = {0, 1};
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types;
+   std::vector<unsigned int> tids;
+
+   // A strided pattern that revisits lines, so there are hits, misses,
+   // writebacks and sequential prefetches
+   for (uint64_t i = 0; i < 5000; ++i) {
+      addrs.push_back((i % 4 == 0 ? i % 16 : (i * 7) % 1500) << 6);
+      types.push_back(i % 3 == 0 ? AccessType::Write : AccessType::Read);
+      tids.push_back(i % 2);
+   }
+
+   std::unique_ptr<System> single = makeSingleCacheSystem(64, 128, 4, 
+                                       std::make_unique<SeqPrefetch>());
+   std::unique_ptr<System> single_batch = makeSingleCacheSystem(64, 128, 4,
+                                       std::make_unique<SeqPrefetch>());
+   std::unique_ptr<System> multi = makeMultiCacheSystem(tid_map, 64, 128, 4,
+                                       std::make_unique<AdjPrefetch>(), 
+                                       false, false, 2);
+   std::unique_ptr<System> multi_batch = makeMultiCacheSystem(tid_map, 64, 128, 4,
+                                       std::make_unique<AdjPrefetch>(), 
+                                       false, false, 2);
+
+   for (size_t i = 0; i < addrs.size(); ++i) {
+      single->memAccess(addrs[i], types[i], tids[i]);
+      multi->memAccess(addrs[i], types[i], tids[i]);
+   }
+
+   // Uneven batch sizes, including empty batches
+   size_t pos = 0;
+   for (size_t len = 0; pos < addrs.size(); len = (len * 5 + 3) % 700) {
+      len = std::min(len, addrs.size() - pos);
+      single_batch->memAccessBatch(&addrs[pos], &types[pos], &tids[pos], len);
+      multi_batch->memAccessBatch(&addrs[pos], &types[pos], &tids[pos], len);
+      pos += len;
+   }
+
+   REQUIRE(single->stats.accesses == 5000);
+   REQUIRE(single->stats.hits > 0);
+   REQUIRE(single_batch->stats.accesses == single->stats.accesses);
+   REQUIRE(single_batch->stats.hits == single->stats.hits);
+   REQUIRE(single_batch->stats.local_reads == single->stats.local_reads);
+   REQUIRE(single_batch->stats.local_writes == single->stats.local_writes);
+   REQUIRE(single_batch->stats.prefetched == single->stats.prefetched);
+
+   REQUIRE(multi_batch->stats.accesses == multi->stats.accesses);
+   REQUIRE(multi_batch->stats.hits == multi->stats.hits);
+   REQUIRE(multi_batch->stats.local_reads == multi->stats.local_reads);
+   REQUIRE(multi_batch->stats.remote_reads == multi->stats.remote_reads);
+   REQUIRE(multi_batch->stats.othercache_reads == multi->stats.othercache_reads);
+   REQUIRE(multi_batch->stats.local_writes == multi->stats.local_writes);
+   REQUIRE(multi_batch->stats.remote_writes == multi->stats.remote_writes);
+   REQUIRE(multi_batch->stats.prefetched == multi->stats.prefetched);
+}
+
+// Counts the misses it is told about, then prefetches as AdjPrefetch
+class CountingPrefetch : public AdjPrefetch {
+public:
+   int prefetchMiss(uint64_t address, unsigned int tid, System& sys) override
+   {
+      misses++;
+      return AdjPrefetch::prefetchMiss(address, tid, sys);
+   }
+   unsigned int misses{0};
+};
+
+// Counts the accesses it simulates, including its prefetcher's
+class CountingSystem : public SingleCacheSystem {
+public:
+   using SingleCacheSystem::SingleCacheSystem;
+   void memAccess(uint64_t address, AccessType type, unsigned int tid) override
+   {
+      calls++;
+      SingleCacheSystem::memAccess(address, type, tid);
+   }
+   unsigned int calls{0};
+};
+
+TEST_CASE("Subclassed systems and prefetchers", "[system]") {
+   auto prefetch = std::make_unique<CountingPrefetch>();
+   CountingPrefetch* counting = prefetch.get();
+   std::unique_ptr<System> single = makeSingleCacheSystem(64, 128, 4, 
+                                       std::move(prefetch));
+   CountingSystem sys(64, 128, 4, std::make_unique<AdjPrefetch>());
+   for (uint64_t i = 0; i < 100; ++i) {
+      single->memAccess(i << 7, AccessType::Read, 0);
+      sys.memAccess(i << 7, AccessType::Read, 0);
+   }
+
+   // Every access misses and prefetches the next line
+   REQUIRE(counting->misses == 100);
+   REQUIRE(single->stats.prefetched == 100);
+   REQUIRE(sys.calls == 200);
+}
+
+TEST_CASE("Binary trace round trip", "[trace]") {
+   const char* path = "unit_trace.bin";
+   {
+      TraceWriter writer(path, TraceHasTid | TraceHasPC);
+      for (uint64_t i = 0; i < 10000; ++i) {
+         writer.write(i << 6, i % 3 ? AccessType::Read : AccessType::Write, 
+                      i % 5, 0x400000 + i);
+      }
+   }
+
+   REQUIRE(isBinaryTrace(path));
+
+   BinaryTraceReader reader(path);
+   REQUIRE(reader.getHeader().records == 10000);
+   REQUIRE(reader.getHeader().flags == (TraceHasTid | TraceHasPC));
+
+   TraceBlock block(3000);
+   uint64_t i = 0;
+   while (reader.next(block)) {
+      for (size_t j = 0; j < block.size; ++j, ++i) {
+         REQUIRE(block.addrs[j] == i << 6);
+         REQUIRE(block.types[j] == (i % 3 ? AccessType::Read : AccessType::Write));
+         REQUIRE(block.tids[j] == i % 5);
+      }
+   }
+   REQUIRE(i == 10000);
+
+   MappedTraceReader mapped(path);
+   REQUIRE(mapped.getHeader().records == 10000);
+
+   TraceSpan span;
+   i = 0;
+   while (mapped.next(span, 3000)) {
+      for (size_t j = 0; j < span.size; ++j, ++i) {
+         REQUIRE(span[j].address == i << 6);
+         REQUIRE(span[j].type() == (i % 3 ? AccessType::Read : AccessType::Write));
+         REQUIRE(span[j].tid() == i % 5);
+      }
+   }
+   REQUIRE(i == 10000);
+
+   std::remove(path);
+}
+
+TEST_CASE("Pinatrace parsing", "[trace]") {
+   const char* path = "unit_trace.out";
+   {
+      std::ofstream out(path);
+      out << "0x40017a: R 0x7ffd5a2eb1b0\n"
+          << "0x40026c: W 0X7FFD5A266338\r\n"
+          << "# comment\n"
+          << "\n"
+          << "0x400109: R 0x0\n"
+          << "0x400229: X 0x600010\n"
+          << "garbage\n"
+          << "4000ed: W 600010\n"
+          << "0x400ff0: R 0xffffffffffffffff\n"
+          << "0x400100: R 0x1234";
+   }
+
+   PinatraceParser parser(path);
+   TraceBlock block(2);
+   std::vector<uint64_t> pcs(block.capacity());
+   std::vector<uint64_t> addrs, pc_list;
+   std::vector<AccessType> types;
+   while (parser.next(block, pcs.data())) {
+      addrs.insert(addrs.end(), block.addrs.begin(), block.addrs.begin() + block.size);
+      types.insert(types.end(), block.types.begin(), block.types.begin() + block.size);
+      pc_list.insert(pc_list.end(), pcs.begin(), pcs.begin() + block.size);
+   }
+
+   REQUIRE(addrs == std::vector<uint64_t>({0x7ffd5a2eb1b0, 0x7ffd5a266338, 
+                                           0x600010, 0xffffffffffffffff, 0x1234}));
+   REQUIRE(types == std::vector<AccessType>({AccessType::Read, AccessType::Write,
+                     AccessType::Write, AccessType::Read, AccessType::Read}));
+   REQUIRE(pc_list == std::vector<uint64_t>({0x40017a, 0x40026c, 0x4000ed, 
+                                             0x400ff0, 0x400100}));
+   // The null address and the two malformed lines
+   REQUIRE(parser.getSkipped() == 3);
+
+   std::string error;
+   REQUIRE(openTrace(path, TraceFormat::Text, error));
+   REQUIRE(!openTrace(path, TraceFormat::Binary, error));
+   REQUIRE(error == std::string(path) + " is not a binary trace");
+
+   std::remove(path);
+}
+
+TEST_CASE("Trace pipeline", "[trace]") {
+   uint64_t produced = 0;
+   auto reader = [&](TraceBlock& block) {
+      if (produced == 100000) {
+         return false;
+      }
+      block.size = std::min<size_t>(block.capacity(), 100000 - produced);
+      for (size_t i = 0; i < block.size; ++i) {
+         block.addrs[i] = produced++;
+      }
+      return true;
+   };
+
+   SECTION("All blocks arrive in order") {
+      TracePipeline pipeline(reader, 4, 1000);
+      uint64_t expected = 0;
+      while (const TraceBlock* block = pipeline.next()) {
+         for (size_t i = 0; i < block->size; ++i) {
+            REQUIRE(block->addrs[i] == expected++);
+         }
+      }
+      REQUIRE(expected == 100000);
+      REQUIRE(pipeline.next() == nullptr);
+   }
+
+   SECTION("Destroying the pipeline stops the reader") {
+      {
+         TracePipeline pipeline(reader, 4, 1000);
+         REQUIRE(pipeline.next()->addrs[0] == 0);
+      }
+      REQUIRE(produced < 100000);
+   }
+}
+
+TEST_CASE("Compressed trace round trip", "[trace]") {
+   const char* path = "unit_trace.bin";
+   // Strides with some jumps back, so deltas of both signs are encoded
+   auto address = [](uint64_t i) { 
+      return (i % 7 == 0 ? 0x7ffd00000000 : 0x600000) + (i % 1000) * 24; 
+   };
+   // Many threads, including TIDs too large for a varint tag byte, or
+   // one thread that isn't TID 0
+   bool mixed = true;
+   auto tid = [&](uint64_t i) -> unsigned int { 
+      if (!mixed) {
+         return 7;
+      }
+      return i % 11 == 0 ? 1000 : i % 13 == 0 ? traceMaxTid : i % 40; 
+   };
+
+   for (unsigned int run = 0; run < 3; ++run) {
+      TraceEncoding encoding = run == 0 ? TraceDeltaPlanar : TraceVarint;
+      mixed = run < 2;
+      {
+         TraceWriter writer(path, TraceHasTid | TraceHasPC | TraceCompressed, 
+                            1000, encoding);
+         for (uint64_t i = 0; i < 10500; ++i) {
+            writer.write(address(i), i % 3 ? AccessType::Read : AccessType::Write,
+                         tid(i), 0x400000 + i % 17);
+         }
+      }
+
+      CompressedTraceReader reader(path, 3);
+      REQUIRE(reader.getHeader().records == 10500);
+      REQUIRE(reader.hasTids());
+
+      TraceBlock block(768);
+      uint64_t i = 0;
+      while (reader.next(block)) {
+         for (size_t j = 0; j < block.size; ++j, ++i) {
+            REQUIRE(block.addrs[j] == address(i));
+            REQUIRE(block.types[j] == (i % 3 ? AccessType::Read : AccessType::Write));
+            REQUIRE(block.tids[j] == tid(i));
+         }
+      }
+      REQUIRE(i == 10500);
+   }
+
+   std::remove(path);
+}
+
+TEST_CASE("Traces of unknown length", "[trace]") {
+   const char* path = "unit_trace.bin";
+   {
+      TraceWriter writer(path, 0);
+      for (uint64_t i = 0; i < 5000; ++i) {
+         writer.write(i << 6, AccessType::Read, 0);
+      }
+   }
+   // As left by a writer to a pipe, or one that did not finish
+   {
+      std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+      file.seekp(offsetof(TraceHeader, records));
+      file.write((const char*) &traceUnknownRecords, sizeof(traceUnknownRecords));
+   }
+
+   BinaryTraceReader streamed(path);
+   std::string error;
+   std::unique_ptr<TraceReader> mapped = openTrace(path, TraceFormat::Auto, 
+                                                   error);
+   REQUIRE(mapped);
+   // The format given must be the file's
+   REQUIRE(!openTrace(path, TraceFormat::Text, error));
+   REQUIRE(!error.empty());
+   REQUIRE(!openTrace("no/such/trace", TraceFormat::Auto, error));
+   for (TraceReader* reader : {(TraceReader*) &streamed, mapped.get()}) {
+      TraceBlock block(1024);
+      uint64_t i = 0;
+      while (reader->next(block)) {
+         for (size_t j = 0; j < block.size; ++j, ++i) {
+            REQUIRE(block.addrs[j] == i << 6);
+         }
+      }
+      REQUIRE(i == 5000);
+   }
+
+   std::remove(path);
+}
+
+TEST_CASE("System configs", "[config]") {
+   SystemConfig config;
+   std::string error;
+
+   REQUIRE(parseConfig(config, "system=single,lines=4096,assoc=8,prefetch=none,"
+                       "domains=1,compulsory=y", error));
+   REQUIRE(config.type == SystemType::Single);
+   REQUIRE(config.numLines == 4096);
+   REQUIRE(config.assoc == 8);
+   REQUIRE(config.prefetcher == PrefetcherType::None);
+   REQUIRE(config.countCompulsory);
+   REQUIRE(checkConfig(config, error));
+
+   SystemConfig copy;
+   REQUIRE(parseConfig(copy, configString(config), error));
+   REQUIRE(configString(copy) == configString(config));
+
+   std::set<std::string> keys;
+   REQUIRE(parseConfig(config, "replacement=random,seed=42", error, &keys));
+   REQUIRE(keys == std::set<std::string>({"replacement", "seed"}));
+   REQUIRE(config.replacement.seed == 42);
+   REQUIRE(parseConfig(copy, configString(config), error));
+   REQUIRE(copy.replacement.seed == 42);
+   REQUIRE(parseConfig(config, "replacement=lru", error));
+
+   REQUIRE(parseConfig(config, "system=multi,domains=2,tid_map=1:0:1", error));
+   REQUIRE(config.tidToDomain == std::vector<unsigned int>({1, 0, 1}));
+   REQUIRE(checkConfig(config, error));
+
+   REQUIRE_FALSE(parseConfig(config, "assoc=many", error));
+   REQUIRE_FALSE(parseConfig(config, "lines=99999999999999999999", error));
+   REQUIRE_FALSE(parseConfig(config, "lines=4294968320", error));
+   REQUIRE_FALSE(parseConfig(config, "seed=18446744073709551616", error));
+   REQUIRE_FALSE(parseConfig(config, "domains=0", error));
+   REQUIRE(parseConfig(config, "seed=18446744073709551615", error));
+   REQUIRE_FALSE(parseConfig(config, "colour=blue", error));
+   REQUIRE(parseConfig(config, "tid_map=0:2", error));
+   REQUIRE_FALSE(checkConfig(config, error));
+
+   // As the drivers parse numbers of their own options
+   unsigned int n;
+   REQUIRE(parseUnsigned("12", n));
+   REQUIRE(n == 12);
+   REQUIRE_FALSE(parseUnsigned("3x", n));
+   REQUIRE_FALSE(parseUnsigned("-1", n));
+   REQUIRE_FALSE(parseUnsigned("", n));
+
+   // The system behaves as one created directly
+   SystemConfig single;
+   REQUIRE(parseConfig(single, "system=single,domains=1,lines=256,assoc=4", error));
+   std::unique_ptr<ConfiguredSystem> configured = makeSystem(single);
+   std::unique_ptr<System> direct = makeSingleCacheSystem(64, 256, 4, 
+                                       std::make_unique<SeqPrefetch>());
+   for (uint64_t i = 0; i < 10000; ++i) {
+      uint64_t address = ((i * 7919) % 3000) << 6;
+      configured->sys->memAccess(address, AccessType::Read, 0);
+      direct->memAccess(address, AccessType::Read, 0);
+   }
+   REQUIRE(configured->sys->stats.hits == direct->stats.hits);
+   REQUIRE(configured->sys->stats.prefetched == direct->stats.prefetched);
+}
+
+TEST_CASE("Configuration sweeps", "[config]") {
+   const uint64_t accesses = 50000;
+   auto access = [](uint64_t i) { return ((i * 7919) % 5000) << 6; };
+   uint64_t produced = 0;
+   auto reader = [&](TraceBlock& block) {
+      if (produced == accesses) {
+         return false;
+      }
+      block.size = std::min<size_t>(block.capacity(), accesses - produced);
+      for (size_t i = 0; i < block.size; ++i, ++produced) {
+         block.addrs[i] = access(produced);
+         block.types[i] = produced % 3 ? AccessType::Read : AccessType::Write;
+         block.tids[i] = produced % 2;
+      }
+      return true;
+   };
+
+   std::vector<std::string> lists = {"assoc=4", "assoc=16,prefetch=none", 
+      "system=single,domains=1,lines=4096", "lines=256,prefetch=adjacent"};
+   std::vector<std::unique_ptr<ConfiguredSystem>> systems;
+   std::vector<System*> sweep;
+   std::string error;
+   for (const std::string& list : lists) {
+      SystemConfig config;
+      REQUIRE(parseConfig(config, list, error));
+      systems.push_back(makeSystem(config));
+      sweep.push_back(systems.back()->sys.get());
+   }
+
+   // Each system sees the whole trace, as if simulated alone
+   REQUIRE(simulateSweep(reader, sweep, 3, 4, 1000) == accesses);
+   for (const std::unique_ptr<ConfiguredSystem>& configured : systems) {
+      std::unique_ptr<ConfiguredSystem> alone = makeSystem(configured->config);
+      for (uint64_t i = 0; i < accesses; ++i) {
+         alone->sys->memAccess(access(i), 
+                               i % 3 ? AccessType::Read : AccessType::Write, i % 2);
+      }
+      REQUIRE(configured->sys->stats.hits == alone->sys->stats.hits);
+      REQUIRE(configured->sys->stats.remote_reads == alone->sys->stats.remote_reads);
+      REQUIRE(configured->sys->stats.othercache_reads == 
+              alone->sys->stats.othercache_reads);
+   }
+}
+
+TEST_CASE("Stack distances", "[system]") {
+   const unsigned int sets = 16;
+   const unsigned int max_assoc = 32;
+   StackDistanceSystem stack(64, sets, max_assoc, true);
+
+   std::vector<uint64_t> addrs;
+   uint64_t state = 12345;
+   for (unsigned int i = 0; i < 200000; ++i) {
+      // Mostly reuse of a small working set, with some lines deep enough
+      // to be dropped from the stacks
+      uint64_t r = nextRandom(state);
+      uint64_t lines = (r >> 60) < 12 ? 600 : 20000;
+      addrs.push_back(((r >> 20) % lines) << 6);
+   }
+   stack.memAccessBatch(addrs.data(), nullptr, nullptr, addrs.size());
+
+   // The misses of each associativity are those of an LRU cache
+   std::vector<uint64_t> misses = stack.missCurve();
+   REQUIRE(misses.size() == max_assoc);
+   for (unsigned int assoc : {1, 2, 3, 8, 13, 32}) {
+      SingleCacheSystem cache(64, sets * assoc, assoc, nullptr, true);
+      for (uint64_t address : addrs) {
+         cache.memAccess(address, AccessType::Read, 0);
+      }
+      REQUIRE(stack.getHits(assoc) == cache.stats.hits);
+      REQUIRE(misses[assoc - 1] == addrs.size() - cache.stats.hits);
+      REQUIRE(stack.stats.compulsory == cache.stats.compulsory);
+   }
+   REQUIRE(stack.stats.hits == stack.getHits(max_assoc));
+}
+
+TEST_CASE("Parallel single cache", "[system]") {
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types;
+   std::vector<unsigned int> tids;
+   randomAccesses(987, 100000, 1 << 16, 1, addrs, types, tids);
+
+   for (bool translate : {false, true}) {
+      SingleCacheSystem serial(64, 2048, 8, nullptr, true, translate);
+      ParallelSingleCacheSystem parallel(64, 2048, 8, 4, true, translate);
+      serial.memAccessBatch(addrs.data(), types.data(), tids.data(), 50000);
+      parallel.memAccessBatch(addrs.data(), types.data(), tids.data(), 50000);
+      for (size_t i = 50000; i < addrs.size(); ++i) {
+         serial.memAccess(addrs[i], types[i], 0);
+         parallel.memAccess(addrs[i], types[i], 0);
+      }
+      parallel.sync();
+
+      REQUIRE(parallel.stats.accesses == serial.stats.accesses);
+      REQUIRE(parallel.stats.hits == serial.stats.hits);
+      REQUIRE(parallel.stats.local_reads == serial.stats.local_reads);
+      REQUIRE(parallel.stats.local_writes == serial.stats.local_writes);
+      REQUIRE(parallel.stats.compulsory == serial.stats.compulsory);
+   }
+}
+
+TEST_CASE("Parallel multi cache", "[system]") {
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types;
+   std::vector<unsigned int> tids;
+   // Threads sharing a region, so pages are first touched by either
+   randomAccesses(4321, 100000, 1 << 14, 4, addrs, types, tids);
+   std::vector<unsigned int> tid_to_domain = {0, 1, 1, 0};
+
+   for (bool translate : {false, true}) {
+      MultiCacheSystem serial(tid_to_domain, 64, 4096, 8, nullptr, true, 
+                              translate, 2);
+      ParallelMultiCacheSystem parallel(tid_to_domain, 64, 4096, 8, 8, true, 
+                                        translate, 2);
+      serial.memAccessBatch(addrs.data(), types.data(), tids.data(), 50000);
+      parallel.memAccessBatch(addrs.data(), types.data(), tids.data(), 50000);
+      for (size_t i = 50000; i < addrs.size(); ++i) {
+         serial.memAccess(addrs[i], types[i], tids[i]);
+         parallel.memAccess(addrs[i], types[i], tids[i]);
+      }
+      parallel.sync();
+
+      REQUIRE(parallel.stats.accesses == serial.stats.accesses);
+      REQUIRE(parallel.stats.hits == serial.stats.hits);
+      REQUIRE(parallel.stats.local_reads == serial.stats.local_reads);
+      REQUIRE(parallel.stats.remote_reads == serial.stats.remote_reads);
+      REQUIRE(parallel.stats.othercache_reads == serial.stats.othercache_reads);
+      REQUIRE(parallel.stats.local_writes == serial.stats.local_writes);
+      REQUIRE(parallel.stats.remote_writes == serial.stats.remote_writes);
+      REQUIRE(parallel.stats.compulsory == serial.stats.compulsory);
+   }
+}
+
+TEST_CASE("Sampled simulation", "[system]") {
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types(100000, AccessType::Read);
+   std::vector<unsigned int> tids(100000, 0);
+   for (unsigned int i = 0; i < 100000; ++i) {
+      addrs.push_back(((i * 7919) % 3000) << 6);
+   }
+
+   SECTION("Windows are the simulated accesses at the end of each period") {
+      SampledSystem sampled(std::make_unique<SingleCacheSystem>(64, 1024, 8, 
+                                 nullptr), 10000, 3000, 1000);
+      SingleCacheSystem direct(64, 1024, 8, nullptr);
+      sampled.memAccessBatch(addrs.data(), types.data(), tids.data(), 55555);
+      sampled.memAccessBatch(addrs.data() + 55555, types.data(), tids.data(), 
+                             addrs.size() - 55555);
+      sampled.sync();
+
+      uint64_t hits = 0;
+      for (size_t i = 0; i < addrs.size(); ++i) {
+         if (i % 10000 < 6000) {
+            continue;
+         }
+         uint64_t before = direct.stats.hits;
+         direct.memAccess(addrs[i], AccessType::Read, 0);
+         if (i % 10000 >= 9000) {
+            hits += direct.stats.hits - before;
+         }
+      }
+
+      REQUIRE(sampled.getTraceAccesses() == addrs.size());
+      REQUIRE(sampled.getWindows().size() == 10);
+      REQUIRE(sampled.stats.accesses == 10000);
+      REQUIRE(sampled.stats.hits == hits);
+      SampleEstimate estimate = sampled.estimate(&SystemStats::hits);
+      REQUIRE(estimate.mean == Approx(hits / 10000.0));
+      REQUIRE(estimate.halfWidth >= 0);
+   }
+
+   SECTION("Detailing every access gives the full simulation") {
+      SampledSystem sampled(std::make_unique<SingleCacheSystem>(64, 1024, 8, 
+                                 nullptr), 1000, 0, 1000);
+      SingleCacheSystem direct(64, 1024, 8, nullptr);
+      for (size_t i = 0; i < addrs.size(); ++i) {
+         sampled.memAccess(addrs[i], AccessType::Read, 0);
+         direct.memAccess(addrs[i], AccessType::Read, 0);
+      }
+      sampled.sync();
+      REQUIRE(sampled.stats.hits == direct.stats.hits);
+      REQUIRE(sampled.estimate(&SystemStats::hits).mean == 
+              Approx((double) direct.stats.hits / addrs.size()));
+   }
+
+   SECTION("Skipped accesses still place pages and mark lines as seen") {
+      // Each period, thread 1 touches lines 0-4 of a new page in the
+      // skipped accesses, then thread 0 reads lines 0-9 in the window
+      std::vector<uint64_t> period_addrs;
+      std::vector<unsigned int> period_tids;
+      for (uint64_t page = 0; page < 20; ++page) {
+         for (unsigned int j = 0; j < 100; ++j) {
+            period_addrs.push_back((page << 12) + 
+                                   ((j < 90 ? j % 5 : j - 90) << 6));
+            period_tids.push_back(j < 90 ? 1 : 0);
+         }
+      }
+      std::vector<unsigned int> tid_to_domain = {0, 1};
+
+      for (bool translate : {false, true}) {
+         for (unsigned int workers : {1, 2}) {
+            std::unique_ptr<System> sys;
+            if (workers == 1) {
+               sys = std::make_unique<MultiCacheSystem>(tid_to_domain, 64, 
+                        1024, 8, nullptr, true, translate, 2);
+            } else {
+               sys = std::make_unique<ParallelMultiCacheSystem>(tid_to_domain, 
+                        64, 1024, 8, workers, true, translate, 2);
+            }
+            SampledSystem sampled(std::move(sys), 100, 0, 10);
+            sampled.memAccessBatch(period_addrs.data(), types.data(), 
+                                   period_tids.data(), period_addrs.size());
+            sampled.sync();
+
+            REQUIRE(sampled.stats.accesses == 200);
+            REQUIRE(sampled.stats.remote_reads == 200);
+            REQUIRE(sampled.stats.local_reads == 0);
+            REQUIRE(sampled.stats.compulsory == 100);
+         }
+      }
+   }
+}
+
+TEST_CASE("Set sampling", "[system]") {
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types;
+   std::vector<unsigned int> tids;
+   randomAccesses(777, 100000, 1 << 16, 1, addrs, types, tids);
+   // With 1024 sets, every fourth group of a page's worth of sets
+   std::vector<uint64_t> sampled_addrs;
+   for (uint64_t address : addrs) {
+      if ((address >> pageShift) % 4 == 0) {
+         sampled_addrs.push_back(address);
+      }
+   }
+
+   SingleCacheSystem sampled(64, 4096, 4, nullptr, true, false, 4);
+   SingleCacheSystem direct(64, 4096, 4, nullptr, true);
+   sampled.memAccessBatch(addrs.data(), types.data(), tids.data(), addrs.size());
+   for (uint64_t address : sampled_addrs) {
+      direct.memAccess(address, AccessType::Read, 0);
+   }
+
+   // Without a prefetcher the sampled sets behave as in a full simulation
+   REQUIRE(sampled.stats.accesses == sampled_addrs.size());
+   REQUIRE(sampled.stats.hits == direct.stats.hits);
+   REQUIRE(sampled.stats.compulsory == direct.stats.compulsory);
+   SampleEstimate estimate = sampled.estimateHitRate();
+   REQUIRE(estimate.mean == Approx((double) direct.stats.hits / 
+                                   sampled_addrs.size()));
+   REQUIRE(estimate.halfWidth > 0);
+   REQUIRE(direct.estimateHitRate().halfWidth == 0);
+
+   // Prefetches outside the sampled sets are dropped, so they don't
+   // change the sampled sets either
+   std::vector<unsigned int> tid_to_domain = {0, 1};
+   for (unsigned int tid = 0; tid < tids.size(); ++tid) {
+      tids[tid] = tid % 2;
+   }
+   MultiCacheSystem multi(tid_to_domain, 64, 4096, 4, 
+                          std::make_unique<AdjPrefetch>(), false, false, 2, 4);
+   MultiCacheSystem filtered(tid_to_domain, 64, 4096, 4, 
+                             std::make_unique<AdjPrefetch>(), false, false, 2, 4);
+   for (size_t i = 0; i < addrs.size(); ++i) {
+      multi.memAccess(addrs[i], types[i], tids[i]);
+      if ((addrs[i] >> pageShift) % 4 == 0) {
+         filtered.memAccess(addrs[i], types[i], tids[i]);
+      }
+   }
+   REQUIRE(multi.stats.accesses == sampled_addrs.size());
+   REQUIRE(multi.stats.hits == filtered.stats.hits);
+   REQUIRE(multi.stats.remote_reads == filtered.stats.remote_reads);
+   REQUIRE(multi.stats.othercache_reads == filtered.stats.othercache_reads);
+}
+
+TEST_CASE("Replacement policies", "[cache]") {
+   SECTION("LRU") {
+      Cache cache(16, 4);
+      fillSet(cache, 1);
+      REQUIRE(cache.getTag(cache.victim(1)) == 1 << 12);
+
+      cache.touch(cache.lookup(1, 1 << 12));
+      cache.touch(cache.lookup(1, 3 << 12));
+      REQUIRE(cache.getTag(cache.victim(1)) == 2 << 12);
+      cache.replace(cache.victim(1), 5 << 12, CacheState::Exclusive);
+      REQUIRE(cache.getTag(cache.victim(1)) == 4 << 12);
+
+      // Empty ways are replaced first
+      cache.setState(cache.lookup(1, 3 << 12), CacheState::Invalid);
+      REQUIRE(cache.getState(cache.victim(1)) == CacheState::Invalid);
+      REQUIRE(cache.lookup(1, 3 << 12).found() == false);
+      // Other sets are untouched
+      REQUIRE(cache.getState(cache.victim(0)) == CacheState::Invalid);
+   }
+
+   SECTION("Tree PLRU") {
+      BasicCache<0, TreePlruPolicy> cache(16, 4);
+      RuntimeCache runtime(16, 4, {ReplacementType::TreePlru});
+      fillSet(cache, 1);
+      fillSet(runtime, 1);
+      REQUIRE(cache.getTag(cache.victim(1)) == 1 << 12);
+
+      // Line 3 is in the half of the tree not accessed last, although
+      // line 2 is least recently used
+      cache.touch(cache.lookup(1, 1 << 12));
+      runtime.touch(runtime.lookup(1, 1 << 12));
+      REQUIRE(cache.getTag(cache.victim(1)) == 3 << 12);
+      REQUIRE(runtime.getTag(runtime.victim(1)) == 3 << 12);
+
+      // The empty way is filled first
+      CacheWay way = cache.lookup(1, 2 << 12);
+      cache.setState(way, CacheState::Invalid);
+      REQUIRE(cache.victim(1).index == way.index);
+   }
+
+   SECTION("Bit PLRU") {
+      BasicCache<4, BitPlruPolicy> cache(16, 4);
+      RuntimeCache runtime(16, 4, {ReplacementType::BitPlru});
+      fillSet(cache, 1);
+      fillSet(runtime, 1);
+      // Filling the last way cleared the other MRU bits
+      REQUIRE(cache.getTag(cache.victim(1)) == 1 << 12);
+
+      cache.touch(cache.lookup(1, 1 << 12));
+      cache.touch(cache.lookup(1, 3 << 12));
+      runtime.touch(runtime.lookup(1, 1 << 12));
+      runtime.touch(runtime.lookup(1, 3 << 12));
+      REQUIRE(cache.getTag(cache.victim(1)) == 2 << 12);
+      REQUIRE(runtime.getTag(runtime.victim(1)) == 2 << 12);
+
+      cache.touch(cache.lookup(1, 2 << 12));
+      REQUIRE(cache.getTag(cache.victim(1)) == 1 << 12);
+   }
+
+   SECTION("RRIP") {
+      BasicCache<4, RripPolicy> srrip(16, 4, {ReplacementType::Srrip});
+      fillSet(srrip, 1);
+      REQUIRE(srrip.getTag(srrip.victim(1)) == 1 << 12);
+
+      // Lines 2 to 4 age to 3 when line 5 replaces line 2
+      srrip.touch(srrip.lookup(1, 1 << 12));
+      REQUIRE(srrip.getTag(srrip.victim(1)) == 2 << 12);
+      srrip.replace(srrip.victim(1), 5 << 12, CacheState::Exclusive);
+      REQUIRE(srrip.getTag(srrip.victim(1)) == 3 << 12);
+      REQUIRE(srrip.getReplacementStats().rrpvInserts[2] == 5);
+
+      // BRRIP inserts at 3, so the first line not hit since is replaced
+      RuntimeCache brrip(16, 4, {ReplacementType::Brrip});
+      fillSet(brrip, 1);
+      brrip.touch(brrip.lookup(1, 1 << 12));
+      REQUIRE(brrip.getTag(brrip.victim(1)) == 2 << 12);
+      REQUIRE(brrip.getReplacementStats().rrpvInserts[3] == 4);
+   }
+
+   SECTION("DRRIP set dueling") {
+      // With 256 sets, sets 0 and 4 lead SRRIP and BRRIP among each 8
+      BasicCache<0, RripPolicy> cache(1024, 4, {ReplacementType::Drrip});
+      auto fill = [&cache](uint64_t set, uint64_t n) {
+         for (uint64_t i = 0; i < n; ++i) {
+            cache.replace(cache.victim(set), (i + 1) << 20, 
+                          CacheState::Exclusive);
+         }
+      };
+
+      // SRRIP's leader misses more, so the followers use BRRIP
+      fill(0, 1);
+      fill(1, 1);
+      REQUIRE(cache.getReplacementStats().rrpvInserts[3] == 1);
+      fill(4, 2);
+      fill(1, 1);
+      REQUIRE(cache.getReplacementStats().rrpvInserts[2] == 2);
+
+      fill(0, RripPolicy::pselPeriod - 5);
+      ReplacementStats stats = cache.getReplacementStats();
+      REQUIRE(stats.psel.size() == 1);
+      REQUIRE(stats.psel[0] == std::vector<uint16_t>{(1 << RripPolicy::pselBits) - 1});
+
+      // Later copies of the stats less earlier ones leave the samples
+      // taken in between
+      ReplacementStats later = stats;
+      later.psel[0].push_back(7);
+      later -= stats;
+      REQUIRE(later.psel[0] == std::vector<uint16_t>{7});
+
+      // Small caches still have followers. With 16 sets, sets 0 mod 4
+      // lead SRRIP and 2 mod 4 BRRIP
+      BasicCache<0, RripPolicy> small(64, 4, {ReplacementType::Drrip});
+      auto fill_small = [&](uint64_t set) {
+         small.replace(small.victim(set), (set + 1) << 20, CacheState::Exclusive);
+      };
+      // PSEL starts with its top bit set, and a BRRIP leader's miss
+      // clears it, so set 1 follows SRRIP
+      fill_small(2);
+      REQUIRE(small.getReplacementStats().rrpvInserts[3] == 1);
+      fill_small(1);
+      REQUIRE(small.getReplacementStats().rrpvInserts[2] == 1);
+      fill_small(4);
+      fill_small(3);
+      REQUIRE(small.getReplacementStats().rrpvInserts[3] == 2);
+
+      SystemConfig tiny;
+      std::string error;
+      REQUIRE(parseConfig(tiny, "system=single,domains=1,lines=8,assoc=4,"
+                          "replacement=drrip", error));
+      REQUIRE(!checkConfig(tiny, error));
+      REQUIRE(parseConfig(tiny, "lines=16", error));
+      REQUIRE(checkConfig(tiny, error));
+
+      // Every cache of a system reports its own counter
+      std::vector<unsigned int> tid_to_domain = {0, 1};
+      MultiCacheSystem multi(tid_to_domain, 64, 1024, 4, nullptr, false, false,
+                             2, 1, {ReplacementType::Drrip});
+      for (uint64_t i = 0; i < 2 * RripPolicy::pselPeriod + 100; ++i) {
+         multi.memAccess(i << 6, AccessType::Read, i % 2);
+      }
+      multi.sync();
+      REQUIRE(multi.stats.replacement.psel.size() == 2);
+      REQUIRE(multi.stats.replacement.psel[0].size() == 1);
+      REQUIRE(multi.stats.replacement.psel[1].size() == 1);
+   }
+
+   SECTION("FIFO") {
+      BasicCache<4, FifoPolicy> cache(16, 4);
+      RuntimeCache runtime(16, 4, {ReplacementType::Fifo});
+      fillSet(cache, 1);
+      fillSet(runtime, 1);
+      // Hits don't matter, lines leave in the order they came
+      cache.touch(cache.lookup(1, 1 << 12));
+      runtime.touch(runtime.lookup(1, 1 << 12));
+      for (uint64_t line = 1; line <= 4; ++line) {
+         REQUIRE(cache.getTag(cache.victim(1)) == line << 12);
+         REQUIRE(runtime.getTag(runtime.victim(1)) == line << 12);
+         cache.replace(cache.victim(1), (line + 4) << 12, CacheState::Exclusive);
+         runtime.replace(runtime.victim(1), (line + 4) << 12, 
+                         CacheState::Exclusive);
+      }
+      REQUIRE(cache.getTag(cache.victim(1)) == 5 << 12);
+   }
+
+   SECTION("Random") {
+      ReplacementConfig config(ReplacementType::Random);
+      RandomPolicy a(16, 8, config);
+      RandomPolicy b(16, 8, config);
+      config.seed = 1;
+      RandomPolicy c(16, 8, config);
+      // The caches of a system draw different victims from one seed
+      config.seed = 0;
+      config.stream = 1;
+      RandomPolicy d(16, 8, config);
+      std::vector<unsigned int> counts(8, 0);
+      bool differ = false;
+      bool differ_stream = false;
+      for (unsigned int i = 0; i < 8000; ++i) {
+         // The same seed gives the same victims
+         REQUIRE(a.victim(i % 16, 8) == b.victim(i % 16, 8));
+         REQUIRE(a.victim(i % 16, 8) < 8);
+         differ = differ || a.victim(0, 8) != c.victim(0, 8);
+         differ_stream = differ_stream || a.victim(0, 8) != d.victim(0, 8);
+         counts[a.victim(0, 8)]++;
+         a.fill(i % 16, a.victim(i % 16, 8), 8);
+         b.fill(i % 16, b.victim(i % 16, 8), 8);
+         c.fill(i % 16, c.victim(i % 16, 8), 8);
+         d.fill(i % 16, d.victim(i % 16, 8), 8);
+      }
+      REQUIRE(differ);
+      REQUIRE(differ_stream);
+      for (unsigned int count : counts) {
+         REQUIRE(count > 800);
+         REQUIRE(count < 1200);
+      }
+   }
+
+   SECTION("Single and multi systems agree") {
+      std::vector<uint64_t> addrs;
+      std::vector<AccessType> types;
+      std::vector<unsigned int> tids;
+      randomAccesses(5, 20000, 2048, 1, addrs, types, tids);
+
+      for (const char* policy : {"lru", "tree_plru", "bit_plru", "srrip", 
+                                 "brrip", "drrip", "random", "fifo"}) {
+         SystemConfig single;
+         SystemConfig multi;
+         std::string error;
+         REQUIRE(parseConfig(single, std::string("system=single,domains=1,"
+                       "prefetch=none,lines=256,assoc=8,replacement=") + policy, 
+                       error));
+         REQUIRE(parseConfig(multi, std::string("domains=1,prefetch=none,"
+                       "lines=256,assoc=8,replacement=") + policy, error));
+         auto single_sys = makeSystem(single);
+         auto multi_sys = makeSystem(multi);
+         single_sys->sys->memAccessBatch(addrs.data(), types.data(), 
+                                         tids.data(), addrs.size());
+         multi_sys->sys->memAccessBatch(addrs.data(), types.data(), 
+                                        tids.data(), addrs.size());
+         single_sys->sys->sync();
+         multi_sys->sys->sync();
+         const SystemStats& single_stats = single_sys->sys->stats;
+         const SystemStats& multi_stats = multi_sys->sys->stats;
+         REQUIRE(single_stats.hits > 0);
+         REQUIRE(single_stats.hits == multi_stats.hits);
+         REQUIRE(single_stats.replacement.rrpvInserts[3] == 
+                 multi_stats.replacement.rrpvInserts[3]);
+      }
+
+      SystemConfig config;
+      std::string error;
+      REQUIRE(parseConfig(config, "assoc=12,lines=768,replacement=tree_plru", 
+                          error));
+      REQUIRE(!checkConfig(config, error));
+   }
+
+   SECTION("Parallel systems agree or are rejected") {
+      std::vector<uint64_t> addrs;
+      std::vector<AccessType> types;
+      std::vector<unsigned int> tids;
+      randomAccesses(11, 20000, 4096, 2, addrs, types, tids);
+
+      for (const char* system : {"single,domains=1", "multi,domains=2"}) {
+         for (const char* policy : {"lru", "tree_plru", "bit_plru", "srrip", 
+                                    "brrip", "drrip", "random", "fifo"}) {
+            const std::string options = std::string("system=") + system + 
+                  ",prefetch=none,lines=1024,assoc=8,replacement=" + policy;
+            SystemConfig serial;
+            SystemConfig parallel;
+            std::string error;
+            REQUIRE(parseConfig(serial, options, error));
+            REQUIRE(parseConfig(parallel, options + ",workers=4", error));
+            REQUIRE(checkConfig(serial, error));
+            if (!isPerSet(parallel.replacement.type)) {
+               REQUIRE(!checkConfig(parallel, error));
+               continue;
+            }
+            REQUIRE(checkConfig(parallel, error));
+
+            auto serial_sys = makeSystem(serial);
+            auto parallel_sys = makeSystem(parallel);
+            serial_sys->sys->memAccessBatch(addrs.data(), types.data(), 
+                                            tids.data(), addrs.size());
+            parallel_sys->sys->memAccessBatch(addrs.data(), types.data(), 
+                                              tids.data(), addrs.size());
+            serial_sys->sys->sync();
+            parallel_sys->sys->sync();
+            const SystemStats& serial_stats = serial_sys->sys->stats;
+            const SystemStats& parallel_stats = parallel_sys->sys->stats;
+            REQUIRE(serial_stats.hits > 0);
+            REQUIRE(parallel_stats.hits == serial_stats.hits);
+            REQUIRE(parallel_stats.local_writes == serial_stats.local_writes);
+            REQUIRE(parallel_stats.remote_reads == serial_stats.remote_reads);
+         }
+      }
+   }
+}
+
+TEST_CASE("OPT replacement", "[system]") {
+   SECTION("Next-use distances") {
+      std::string error;
+      REQUIRE_FALSE(makeNextUseIndex(64, "/nonexistent", error));
+      std::shared_ptr<NextUseIndex> made = makeNextUseIndex(64, "", error);
+      REQUIRE(made);
+      NextUseIndex& index = *made;
+      std::vector<uint64_t> addrs = {0x1000, 0x2000, 0x1008, 0x3000, 0x2000, 
+                                     0x1000};
+      REQUIRE(index.add(addrs.data(), 3, error));
+      REQUIRE(index.add(addrs.data() + 3, 3, error));
+      // Enough more to grow the file past its first size, one at a time
+      std::vector<uint64_t> more(1500000);
+      for (size_t i = 0; i < more.size(); ++i) {
+         more[i] = (0x100000 + i) << 6;
+      }
+      more.back() = 0x3000;
+      bool added = true;
+      for (uint64_t address : more) {
+         added &= index.add(address, error);
+      }
+      REQUIRE(added);
+      index.finish();
+
+      REQUIRE(index.size() == 6 + more.size());
+      REQUIRE(index.distance(0) == 2);
+      REQUIRE(index.distance(1) == 3);
+      REQUIRE(index.distance(2) == 3);
+      REQUIRE(index.distance(3) == 2 + more.size());
+      REQUIRE(index.distance(4) == 0);
+      REQUIRE(index.distance(5) == 0);
+      REQUIRE(index.distance(6) == 0);
+      index.release(1 << 20);
+      REQUIRE(index.distance(3) == 2 + more.size());
+   }
+
+   SECTION("Matches Belady's algorithm") {
+      const unsigned int lines = 256, assoc = 8, sets = lines / assoc;
+      std::vector<uint64_t> addrs;
+      std::vector<AccessType> types;
+      std::vector<unsigned int> tids;
+      randomAccesses(7, 20000, 1024, 1, addrs, types, tids);
+
+      // Evicts the line of the set used furthest in the future
+      std::vector<uint64_t> next(addrs.size());
+      std::map<uint64_t, uint64_t> seen;
+      for (size_t i = addrs.size(); i-- > 0;) {
+         auto it = seen.find(addrs[i]);
+         next[i] = it == seen.end() ? ~(uint64_t) 0 : it->second;
+         seen[addrs[i]] = i;
+      }
+      std::vector<std::map<uint64_t, uint64_t>> contents(sets);
+      uint64_t belady_hits = 0;
+      for (size_t i = 0; i < addrs.size(); ++i) {
+         auto& set = contents[(addrs[i] >> 6) % sets];
+         if (set.count(addrs[i])) {
+            belady_hits++;
+         } else if (set.size() == assoc) {
+            auto furthest = std::max_element(set.begin(), set.end(), 
+                  [](const std::pair<const uint64_t, uint64_t>& a, 
+                     const std::pair<const uint64_t, uint64_t>& b) 
+                  { return a.second < b.second; });
+            set.erase(furthest);
+         }
+         set[addrs[i]] = next[i];
+      }
+
+      SystemConfig config;
+      std::string error;
+      REQUIRE(parseConfig(config, "system=single,domains=1,prefetch=none,"
+                          "lines=256,assoc=8,replacement=opt", error));
+      REQUIRE(checkConfig(config, error));
+      config.replacement.nextUse = makeNextUseIndex(64, "", error);
+      REQUIRE(config.replacement.nextUse->add(addrs.data(), addrs.size(), 
+                                                error));
+      config.replacement.nextUse->finish();
+      auto opt = makeSystem(config);
+      opt->sys->memAccessBatch(addrs.data(), types.data(), tids.data(), 
+                               addrs.size());
+      REQUIRE(opt->sys->stats.hits == belady_hits);
+
+      for (const char* policy : {"lru", "drrip"}) {
+         SystemConfig other;
+         REQUIRE(parseConfig(other, std::string("system=single,domains=1,"
+                       "prefetch=none,lines=256,assoc=8,replacement=") + policy, 
+                       error));
+         auto sys = makeSystem(other);
+         sys->sys->memAccessBatch(addrs.data(), types.data(), tids.data(), 
+                                  addrs.size());
+         REQUIRE(sys->sys->stats.hits < belady_hits);
+      }
+
+      REQUIRE(parseConfig(config, "system=multi,domains=2", error));
+      REQUIRE(!checkConfig(config, error));
+   }
+}
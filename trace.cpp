@@ -0,0 +1,976 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __SSSE3__
+#include <tmmintrin.h>
+#endif
+
+#include "trace.h"
+#include "lz.h"
+
+// Reads n bytes, or fewer at the end of the file. Returns the number read
+static size_t readFully(int fd, void* buf, size_t n)
+{
+   size_t done = 0;
+   while (done < n) {
+      ssize_t ret = read(fd, (char*) buf + done, n - done);
+      assert(ret >= 0);
+      if (ret == 0) {
+         break;
+      }
+      done += ret;
+   }
+   return done;
+}
+
+// Opens path for reading, or returns stdin if path is "-"
+// Returns -1 if the file can't be opened
+static int tryOpenInput(const std::string& path)
+{
+   int fd = path == "-" ? STDIN_FILENO : open(path.c_str(), O_RDONLY);
+   if (fd < 0) {
+      return fd;
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+      // Fewer, larger reads from a pipe. Fails harmlessly if the size
+      // is over the user's limit
+      fcntl(fd, F_SETPIPE_SZ, 1 << 20);
+   } else {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+   }
+   return fd;
+}
+
+static int openInput(const std::string& path)
+{
+   int fd = tryOpenInput(path);
+   assert(fd >= 0);
+   return fd;
+}
+
+static TraceHeader makeTraceHeader(uint32_t flags, uint64_t records)
+{
+   TraceHeader header{};
+   std::memcpy(header.magic, traceMagic, sizeof(header.magic));
+   header.version = traceVersion;
+   header.flags = flags;
+   header.recordSize = traceRecordSize(flags);
+   header.records = records;
+   return header;
+}
+
+TraceWriter::TraceWriter(const std::string& path, uint32_t flags, 
+                         size_t block_records /*=traceBlockRecords*/,
+                         TraceEncoding encoding /*=TraceVarint*/) : 
+            out(path == "-" ? "/dev/stdout" : path, std::ofstream::binary), 
+            buffer(traceRecordSize(flags) * block_records),
+            flags(flags), encoding(encoding)
+{
+   assert(out.is_open());
+
+   // Written again with the record count once it is known, if the
+   // output can be seeked
+   TraceHeader header = makeTraceHeader(flags, traceUnknownRecords);
+   out.write((const char*) &header, sizeof(header));
+}
+
+TraceWriter::~TraceWriter()
+{
+   flush();
+
+   TraceHeader header = makeTraceHeader(flags, records);
+   if (out.seekp(0)) {
+      out.write((const char*) &header, sizeof(header));
+   }
+}
+
+void TraceWriter::write(uint64_t address, AccessType type, unsigned int tid,
+                        uint64_t pc /*=0*/)
+{
+   // Larger TIDs would lose their top bit in the record's info
+   assert(tid <= traceMaxTid);
+   const uint32_t record_size = traceRecordSize(flags);
+   if (used + record_size > buffer.size()) {
+      flush();
+   }
+
+   TraceRecord record;
+   record.address = address;
+   record.info = traceRecordInfo(type, tid);
+   std::memcpy(&buffer[used], &record, sizeof(record));
+   if (flags & TraceHasPC) {
+      std::memcpy(&buffer[used + sizeof(record)], &pc, sizeof(pc));
+   }
+
+   used += record_size;
+   ++records;
+}
+
+// Returns the record's PC, stored after the TraceRecord
+static inline uint64_t recordPC(const char* record)
+{
+   uint64_t pc;
+   std::memcpy(&pc, record + sizeof(TraceRecord), sizeof(pc));
+   return pc;
+}
+
+// Writes byte b of value into plane b of a field, for each of its bytes
+template <class T>
+static inline void storePlanes(uint8_t* field, size_t n, size_t i, T value)
+{
+   for (size_t b = 0; b < sizeof(T); ++b) {
+      field[b * n + i] = (uint8_t) (value >> (8 * b));
+   }
+}
+
+// Encodes n packed records as TraceDeltaPlanar
+static void encodeDeltaPlanar(const char* records, size_t n, uint32_t flags,
+                              std::vector<uint8_t>& out)
+{
+   const uint32_t record_size = traceRecordSize(flags);
+   const bool has_pc = flags & TraceHasPC;
+   out.resize(n * record_size);
+   uint8_t* addrs = out.data();
+   uint8_t* infos = addrs + n * sizeof(uint64_t);
+   uint8_t* pcs = infos + n * sizeof(uint32_t);
+
+   uint64_t prev_addr = 0;
+   uint64_t prev_pc = 0;
+   for (size_t i = 0; i < n; ++i) {
+      const char* data = records + i * record_size;
+      TraceRecord record;
+      std::memcpy(&record, data, sizeof(record));
+
+      storePlanes(addrs, n, i, record.address - prev_addr);
+      storePlanes(infos, n, i, record.info);
+      prev_addr = record.address;
+      if (has_pc) {
+         uint64_t pc = recordPC(data);
+         storePlanes(pcs, n, i, pc - prev_pc);
+         prev_pc = pc;
+      }
+   }
+}
+
+// Decodes n records encoded by encodeDeltaPlanar into block, without
+// PCs. Each plane is merged into the values in a separate pass, which
+// the compiler can vectorize
+static void decodeDeltaPlanar(const uint8_t* in, size_t n, TraceBlock& block)
+{
+   const uint8_t* addrs = in;
+   const uint8_t* infos = addrs + n * sizeof(uint64_t);
+   uint64_t* out_addrs = block.addrs.data();
+   unsigned int* out_tids = block.tids.data();
+
+   std::fill_n(out_addrs, n, 0);
+   for (size_t b = 0; b < sizeof(uint64_t); ++b) {
+      const uint8_t* plane = addrs + b * n;
+      for (size_t i = 0; i < n; ++i) {
+         out_addrs[i] |= (uint64_t) plane[i] << (8 * b);
+      }
+   }
+   uint64_t address = 0;
+   for (size_t i = 0; i < n; ++i) {
+      address += out_addrs[i];
+      out_addrs[i] = address;
+   }
+
+   std::fill_n(out_tids, n, 0);
+   for (size_t b = 0; b < sizeof(uint32_t); ++b) {
+      const uint8_t* plane = infos + b * n;
+      for (size_t i = 0; i < n; ++i) {
+         out_tids[i] |= (unsigned int) plane[i] << (8 * b);
+      }
+   }
+   for (size_t i = 0; i < n; ++i) {
+      block.types[i] = (out_tids[i] & 1) ? AccessType::Write : AccessType::Read;
+      out_tids[i] >>= 1;
+   }
+   block.size = n;
+}
+
+// Tag byte TID meaning the TID follows as a varint
+static const unsigned int varintTidEscape = 127;
+// Bytes that decodeVarint may read past the end of the encoded records
+static const size_t varintSlack = 16;
+
+static inline uint64_t zigzag(uint64_t delta)
+{
+   return (delta << 1) ^ (uint64_t) ((int64_t) delta >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t value)
+{
+   return (value >> 1) ^ -(value & 1);
+}
+
+static inline uint8_t* writeVarint(uint8_t* p, uint64_t value)
+{
+   while (value >= 0x80) {
+      *p++ = (uint8_t) (value | 0x80);
+      value >>= 7;
+   }
+   *p++ = (uint8_t) value;
+   return p;
+}
+
+// Reads a varint from p and moves p past it. Varints of up to 8 bytes
+// (56 bits) are decoded from one 8-byte load without branching on each
+// byte, longer ones a byte at a time
+static inline uint64_t readVarint(const uint8_t*& p)
+{
+   uint64_t word;
+   std::memcpy(&word, p, sizeof(word));
+   uint64_t stops = ~word & 0x8080808080808080ULL;
+
+   if (stops) {
+      unsigned int len = __builtin_ctzll(stops) / 8 + 1;
+      p += len;
+      // Keep the varint's bytes, then squeeze out the continuation bits
+      // by merging neighbouring groups of 7, 14 and then 28 bits
+      word &= ~((uint64_t) 0) >> (64 - 8 * len);
+      word &= 0x7f7f7f7f7f7f7f7fULL;
+      word = (word & 0x007f007f007f007fULL) | ((word & 0x7f007f007f007f00ULL) >> 1);
+      word = (word & 0x00003fff00003fffULL) | ((word & 0x3fff00003fff0000ULL) >> 2);
+      word = (word & 0x000000000fffffffULL) | ((word & 0x0fffffff00000000ULL) >> 4);
+      return word;
+   }
+
+   uint64_t value = 0;
+   unsigned int shift = 0;
+   uint8_t b;
+   do {
+      b = *p++;
+      value |= (uint64_t) (b & 0x7f) << shift;
+      shift += 7;
+   } while ((b & 0x80) && shift < 64);
+   return value;
+}
+
+// The previous value of each TID within a block, starting at 0. TIDs
+// can be any 31-bit value, so they are kept in a small open-addressed
+// hash table rather than indexed, and the last TID looked up is
+// remembered since consecutive records are mostly of the same thread
+class PerTidValues {
+public:
+   PerTidValues() : slots(16) {}
+
+   uint64_t& operator[](unsigned int tid)
+   {
+      if (last && last->tid == tid) {
+         return last->value;
+      }
+      last = &find(tid);
+      if (!last->used) {
+         // Only a new TID can take the table past half full
+         if (2 * (used + 1) > slots.size()) {
+            grow();
+            last = &find(tid);
+         }
+         *last = {tid, true, 0};
+         used++;
+      }
+      return last->value;
+   }
+private:
+   struct Slot {
+      unsigned int tid;
+      bool used;
+      uint64_t value;
+   };
+
+   std::vector<Slot> slots; // A power of 2 of them, at most half used
+   size_t used{0};
+   Slot* last{nullptr};
+
+   // The slot of tid, or the empty one where it belongs
+   Slot& find(unsigned int tid)
+   {
+      const size_t mask = slots.size() - 1;
+      size_t i = (tid * 0x9E3779B1u) & mask;
+      while (slots[i].used && slots[i].tid != tid) {
+         i = (i + 1) & mask;
+      }
+      return slots[i];
+   }
+
+   void grow()
+   {
+      std::vector<Slot> old(2 * slots.size());
+      old.swap(slots);
+      for (const Slot& slot : old) {
+         if (slot.used) {
+            find(slot.tid) = slot;
+         }
+      }
+      last = nullptr;
+   }
+};
+
+// Encodes n packed records as TraceVarint
+static void encodeVarint(const char* records, size_t n, uint32_t flags,
+                         std::vector<uint8_t>& out)
+{
+   const uint32_t record_size = traceRecordSize(flags);
+   const bool has_pc = flags & TraceHasPC;
+   // Tag, TID and two 10-byte varints
+   out.resize(n * 26);
+   uint8_t* p = out.data();
+   PerTidValues prev_addrs;
+   PerTidValues prev_pcs;
+
+   for (size_t i = 0; i < n; ++i) {
+      const char* data = records + i * record_size;
+      TraceRecord record;
+      std::memcpy(&record, data, sizeof(record));
+      unsigned int tid = record.tid();
+
+      unsigned int tag_tid = std::min(tid, varintTidEscape);
+      *p++ = (uint8_t) ((tag_tid << 1) | (record.info & 1));
+      if (tag_tid == varintTidEscape) {
+         p = writeVarint(p, tid);
+      }
+
+      uint64_t& prev_addr = prev_addrs[tid];
+      p = writeVarint(p, zigzag(record.address - prev_addr));
+      prev_addr = record.address;
+      if (has_pc) {
+         uint64_t pc = recordPC(data);
+         uint64_t& prev_pc = prev_pcs[tid];
+         p = writeVarint(p, zigzag(pc - prev_pc));
+         prev_pc = pc;
+      }
+   }
+
+   out.resize(p - out.data());
+}
+
+// Decodes n records encoded by encodeVarint from size bytes at in,
+// which must be followed by varintSlack readable bytes, into block
+// without PCs. The varints are decoded first, then the differences
+// are added up, for all records at once if they are all of one TID
+static void decodeVarint(const uint8_t* in, size_t size, size_t n, 
+                         uint32_t flags, TraceBlock& block)
+{
+   const bool has_pc = flags & TraceHasPC;
+   const uint8_t* p = in;
+   uint64_t* addrs = block.addrs.data();
+   unsigned int* tids = block.tids.data();
+   // Set if any record's TID differs from the first's
+   unsigned int tid_diff = 0;
+
+   for (size_t i = 0; i < n; ++i) {
+      uint8_t tag = *p++;
+      unsigned int tid = tag >> 1;
+      if (tid == varintTidEscape) {
+         tid = readVarint(p);
+      }
+      block.types[i] = (tag & 1) ? AccessType::Write : AccessType::Read;
+      tids[i] = tid;
+      tid_diff |= tid ^ tids[0];
+      addrs[i] = readVarint(p);
+      if (has_pc) {
+         readVarint(p);
+      }
+   }
+   assert(p == in + size);
+   (void) size;
+
+   if (tid_diff == 0) {
+      uint64_t address = 0;
+      for (size_t i = 0; i < n; ++i) {
+         address += unzigzag(addrs[i]);
+         addrs[i] = address;
+      }
+   } else {
+      PerTidValues prev_addrs;
+      for (size_t i = 0; i < n; ++i) {
+         uint64_t& prev_addr = prev_addrs[tids[i]];
+         prev_addr += unzigzag(addrs[i]);
+         addrs[i] = prev_addr;
+      }
+   }
+   block.size = n;
+}
+
+void TraceWriter::flush()
+{
+   if (!(flags & TraceCompressed)) {
+      out.write(buffer.data(), used);
+      assert(out.good());
+      used = 0;
+      return;
+   }
+
+   if (used == 0) {
+      return;
+   }
+
+   TraceBlockHeader block;
+   block.records = used / traceRecordSize(flags);
+   block.encoding = encoding;
+   if (encoding == TraceVarint) {
+      encodeVarint(buffer.data(), block.records, flags, encoded);
+   } else {
+      encodeDeltaPlanar(buffer.data(), block.records, flags, encoded);
+   }
+   block.rawSize = encoded.size();
+
+   compressed.resize(lzBound(encoded.size()));
+   block.compressedSize = lzCompress(encoded.data(), encoded.size(), 
+                                     compressed.data());
+   const uint8_t* payload = compressed.data();
+   if (block.compressedSize >= block.rawSize) {
+      block.compressedSize = block.rawSize;
+      payload = encoded.data();
+   }
+
+   out.write((const char*) &block, sizeof(block));
+   out.write((const char*) payload, block.compressedSize);
+   assert(out.good());
+   used = 0;
+}
+
+BinaryTraceReader::BinaryTraceReader(const std::string& path)
+{
+   fd = openInput(path);
+   size_t ret = readFully(fd, &header, sizeof(header));
+   assert(ret == sizeof(header));
+   (void) ret;
+   checkTraceHeader(header);
+   assert(!(header.flags & TraceCompressed));
+
+   remaining = header.records;
+}
+
+BinaryTraceReader::BinaryTraceReader(int fd, const TraceHeader& header) :
+            fd(fd), header(header), remaining(header.records)
+{
+   checkTraceHeader(header);
+   assert(!(header.flags & TraceCompressed));
+}
+
+BinaryTraceReader::~BinaryTraceReader()
+{
+   close(fd);
+}
+
+bool BinaryTraceReader::next(TraceBlock& block)
+{
+   const size_t max_bytes = std::min<uint64_t>(remaining, block.capacity()) *
+                            header.recordSize;
+   if (buffer.size() < max_bytes) {
+      buffer.resize(max_bytes);
+   }
+
+   const size_t bytes = readFully(fd, buffer.data(), max_bytes);
+   const size_t count = bytes / header.recordSize;
+   // Traces of unknown length end at the end of the file
+   assert(bytes == max_bytes || 
+          (header.records == traceUnknownRecords && bytes % header.recordSize == 0));
+
+   for (size_t i = 0; i < count; ++i) {
+      TraceRecord record;
+      std::memcpy(&record, &buffer[i * header.recordSize], sizeof(record));
+      block.addrs[i] = record.address;
+      block.types[i] = record.type();
+      block.tids[i] = record.tid();
+   }
+
+   block.size = count;
+   remaining -= count;
+   return count > 0;
+}
+
+constexpr size_t MappedTraceReader::readAhead;
+
+MappedTraceReader::MappedTraceReader(const std::string& path) : 
+            MappedTraceReader(open(path.c_str(), O_RDONLY))
+{
+}
+
+MappedTraceReader::MappedTraceReader(int fd) : fd(fd)
+{
+   assert(fd >= 0);
+
+   struct stat st;
+   int ret = fstat(fd, &st);
+   assert(ret == 0 && (size_t) st.st_size >= sizeof(header));
+   mapSize = st.st_size;
+
+   map = (const char*) mmap(nullptr, mapSize, PROT_READ, MAP_PRIVATE, fd, 0);
+   assert(map != MAP_FAILED);
+   (void) ret;
+
+   madvise((void*) map, mapSize, MADV_SEQUENTIAL);
+   adviseEnd = std::min(mapSize, readAhead);
+   madvise((void*) map, adviseEnd, MADV_WILLNEED);
+
+   std::memcpy(&header, map, sizeof(header));
+   checkTraceHeader(header);
+   assert(!(header.flags & TraceCompressed));
+   // The trace was not finished if its length is unknown, so it ends
+   // with the last whole record
+   if (header.records == traceUnknownRecords) {
+      header.records = (mapSize - sizeof(header)) / header.recordSize;
+   }
+   assert(sizeof(header) + header.records * header.recordSize <= mapSize);
+   offset = sizeof(header);
+}
+
+MappedTraceReader::~MappedTraceReader()
+{
+   munmap((void*) map, mapSize);
+   close(fd);
+}
+
+bool MappedTraceReader::next(TraceSpan& span, size_t max_records /*=65536*/)
+{
+   const size_t end = sizeof(header) + header.records * header.recordSize;
+   const size_t count = std::min<size_t>((end - offset) / header.recordSize, 
+                                         max_records);
+   const size_t page_size = sysconf(_SC_PAGESIZE);
+
+   span.data = map + offset;
+   span.size = count;
+   span.recordSize = header.recordSize;
+
+   // The previous span has been simulated, so its pages are not needed
+   size_t release = offset & ~(page_size - 1);
+   if (release > releasedEnd) {
+      madvise((void*) (map + releasedEnd), release - releasedEnd, MADV_DONTNEED);
+      releasedEnd = release;
+   }
+
+   offset += count * header.recordSize;
+
+   // Keep readAhead bytes requested beyond the span
+   if (adviseEnd < mapSize && offset + readAhead / 2 > adviseEnd) {
+      size_t start = adviseEnd & ~(page_size - 1);
+      adviseEnd = std::min(mapSize, offset + readAhead);
+      madvise((void*) (map + start), adviseEnd - start, MADV_WILLNEED);
+   }
+
+   return count > 0;
+}
+
+bool MappedTraceReader::next(TraceBlock& block)
+{
+   TraceSpan span;
+   next(span, block.capacity());
+
+   for (size_t i = 0; i < span.size; ++i) {
+      TraceRecord record = span[i];
+      block.addrs[i] = record.address;
+      block.types[i] = record.type();
+      block.tids[i] = record.tid();
+   }
+
+   block.size = span.size;
+   return span.size > 0;
+}
+
+constexpr size_t PinatraceParser::bufferSize;
+constexpr size_t PinatraceParser::padding;
+
+PinatraceParser::PinatraceParser(const std::string& path) : 
+      PinatraceParser(openInput(path), nullptr, 0)
+{
+}
+
+PinatraceParser::PinatraceParser(int fd, const char* data, size_t size) : 
+      fd(fd), buffer(bufferSize + padding), filled(size)
+{
+   assert(size < bufferSize);
+   std::memcpy(buffer.data(), data, size);
+}
+
+PinatraceParser::~PinatraceParser()
+{
+   close(fd);
+}
+
+bool PinatraceParser::refill()
+{
+   char* buf = buffer.data();
+   filled -= pos;
+   std::memmove(buf, buf + pos, filled);
+   pos = 0;
+   end = 0;
+
+   while (end == 0 && !eof) {
+      // A single line must fit in the buffer, leaving room for the
+      // newline added to an unterminated last line
+      assert(filled < bufferSize - 1);
+      ssize_t ret = read(fd, buf + filled, bufferSize - 1 - filled);
+      assert(ret >= 0);
+      if (ret == 0) {
+         eof = true;
+         if (filled > 0 && buf[filled - 1] != '\n') {
+            buf[filled++] = '\n';
+         }
+      }
+      filled += ret;
+
+      const char* last = (const char*) memrchr(buf, '\n', filled);
+      end = last ? last + 1 - buf : 0;
+   }
+
+   std::memset(buf + filled, 0, padding);
+   return end > 0;
+}
+
+// Decodes the hex number at p, with or without a 0x prefix, and moves
+// p past it. Numbers longer than 16 digits are cut short. At least 18
+// bytes must be readable from p
+static inline uint64_t parseHex(const char*& p)
+{
+   p += (p[0] == '0' && (p[1] | 0x20) == 'x') ? 2 : 0;
+#if defined(__SSSE3__)
+   // Find the digits by comparing all 16 characters at once
+   __m128i c = _mm_loadu_si128((const __m128i*) p);
+   __m128i lower = _mm_or_si128(c, _mm_set1_epi8(0x20));
+   __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)),
+                                 _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+   __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                                 _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+   unsigned int other = ~_mm_movemask_epi8(_mm_or_si128(digit, alpha));
+   unsigned int n = __builtin_ctz(other | 0x10000);
+
+   // Shift the digits to the end of the vector, zero filling the
+   // front. Window at offset n holds the shuffle indices for this
+   alignas(16) static const int8_t window[32] = {
+      -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15};
+   c = _mm_shuffle_epi8(c, _mm_loadu_si128((const __m128i*) (window + n)));
+   // '0'-'9' have bit 6 clear and letters have it set, so a digit's
+   // value is its low nibble plus 9 if bit 6 is set
+   __m128i letter = _mm_and_si128(_mm_srli_epi16(c, 6), _mm_set1_epi8(1));
+   __m128i values = _mm_add_epi8(_mm_and_si128(c, _mm_set1_epi8(0xF)),
+                     _mm_add_epi8(letter, _mm_slli_epi16(letter, 3)));
+   // Combine pairs of digits into bytes, most significant first
+   __m128i bytes = _mm_maddubs_epi16(values, _mm_set1_epi16(0x0110));
+   bytes = _mm_packus_epi16(bytes, bytes);
+   p += n;
+   return __builtin_bswap64(_mm_cvtsi128_si64(bytes));
+#else
+   // The digit values are computed arithmetically, so the only branch
+   // is on the number of digits
+   uint64_t value = 0;
+   unsigned int n = 0;
+   for (; n < 16; ++n) {
+      unsigned int c = (unsigned char) p[n];
+      if (!((c >= '0' && c <= '9') || ((c | 0x20) >= 'a' && (c | 0x20) <= 'f'))) {
+         break;
+      }
+      value = (value << 4) | ((c & 0xF) + 9 * (c >> 6));
+   }
+   p += n;
+   return value;
+#endif
+}
+
+bool PinatraceParser::next(TraceBlock& block, uint64_t* pcs /*=nullptr*/)
+{
+   // Locals, since stores to the block could otherwise alias its size
+   uint64_t* addrs = block.addrs.data();
+   AccessType* types = block.types.data();
+   const size_t capacity = block.capacity();
+   size_t n = 0;
+
+   while (n < capacity) {
+      if (pos == end && !refill()) {
+         break;
+      }
+
+      const char* buf = buffer.data();
+      const char* p = buf + pos;
+      const char* const last = buf + end;
+
+      while (p != last && n < capacity) {
+         const char* line = p;
+         uint64_t pc = parseHex(p);
+         bool ok = p != line && *p == ':';
+         p += ok;
+         while (*p == ' ') {
+            ++p;
+         }
+         char rw = *p;
+         ok &= rw == 'R' || rw == 'W';
+         p += ok;
+         while (*p == ' ') {
+            ++p;
+         }
+         const char* digits = p;
+         uint64_t address = parseHex(p);
+         p += *p == '\r';
+         ok &= p != digits && *p == '\n';
+
+         if (ok && address != 0) {
+            addrs[n] = address;
+            types[n] = rw == 'W' ? AccessType::Write : AccessType::Read;
+            if (pcs) {
+               pcs[n] = pc;
+            }
+            ++n;
+            ++p;
+            continue;
+         }
+
+         // Comments and blank lines are not counted as skipped
+         if (*line != '#' && *line != '\n' && *line != '\r') {
+            ++skipped;
+         }
+         p = (const char*) std::memchr(line, '\n', last - line) + 1;
+      }
+
+      pos = p - buf;
+   }
+
+   std::fill_n(block.tids.begin(), n, 0);
+   block.size = n;
+   return n > 0;
+}
+
+CompressedTraceReader::CompressedTraceReader(const std::string& path, 
+                                      unsigned int threads /*=0*/) : 
+            CompressedTraceReader(openInput(path), nullptr, threads)
+{
+}
+
+CompressedTraceReader::CompressedTraceReader(int fd, const TraceHeader* header,
+                                      unsigned int threads /*=0*/) : fd(fd)
+{
+   if (header) {
+      this->header = *header;
+   } else {
+      size_t ret = readFully(fd, &this->header, sizeof(this->header));
+      assert(ret == sizeof(this->header));
+      (void) ret;
+   }
+   checkTraceHeader(this->header);
+   assert(this->header.flags & TraceCompressed);
+
+   if (threads == 0) {
+      threads = std::max(1U, std::thread::hardware_concurrency());
+   }
+   // Enough blocks to keep every thread busy while the oldest is
+   // handed out
+   slots.resize(2 * threads);
+   while (inFlight < slots.size() && readBlock(slots[inFlight])) {
+      ++inFlight;
+   }
+
+   for (unsigned int i = 0; i < threads; ++i) {
+      this->threads.emplace_back(&CompressedTraceReader::decodeLoop, this);
+   }
+}
+
+CompressedTraceReader::~CompressedTraceReader()
+{
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+   }
+   queued.notify_all();
+   for (std::thread& thread : threads) {
+      thread.join();
+   }
+   close(fd);
+}
+
+bool CompressedTraceReader::readBlock(Slot& slot)
+{
+   if (eof) {
+      return false;
+   }
+
+   TraceBlockHeader& block = slot.header;
+   size_t ret = readFully(fd, &block, sizeof(block));
+   if (ret == 0) {
+      eof = true;
+      return false;
+   }
+   assert(ret == sizeof(block));
+   assert(block.encoding == TraceDeltaPlanar || block.encoding == TraceVarint);
+   assert(block.encoding != TraceDeltaPlanar || 
+          block.rawSize == block.records * header.recordSize);
+   assert(block.compressedSize <= block.rawSize);
+
+   // Stored blocks are decoded in place, so need the decoder's slack
+   slot.payload.resize(block.compressedSize + varintSlack);
+   ret = readFully(fd, slot.payload.data(), block.compressedSize);
+   assert(ret == block.compressedSize);
+
+   {
+      std::lock_guard<std::mutex> lock(mutex);
+      slot.ready = false;
+      queue.push_back(&slot);
+   }
+   queued.notify_one();
+   return true;
+}
+
+void CompressedTraceReader::decodeLoop()
+{
+   while (true) {
+      Slot* slot;
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         queued.wait(lock, [this] { return stopping || !queue.empty(); });
+         if (stopping) {
+            return;
+         }
+         slot = queue.front();
+         queue.pop_front();
+      }
+
+      const TraceBlockHeader& block = slot->header;
+      if (slot->decoded.capacity() < block.records) {
+         slot->decoded = TraceBlock(block.records);
+      }
+      const uint8_t* raw = slot->payload.data();
+      if (block.compressedSize != block.rawSize) {
+         slot->raw.resize(block.rawSize + std::max(lzSlack, varintSlack));
+         lzDecompress(raw, block.compressedSize, slot->raw.data(), block.rawSize);
+         raw = slot->raw.data();
+      }
+      if (block.encoding == TraceVarint) {
+         decodeVarint(raw, block.rawSize, block.records, header.flags, 
+                      slot->decoded);
+      } else {
+         decodeDeltaPlanar(raw, block.records, slot->decoded);
+      }
+
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         slot->ready = true;
+      }
+      decoded.notify_one();
+   }
+}
+
+bool CompressedTraceReader::next(TraceBlock& block)
+{
+   while (inFlight > 0) {
+      Slot& slot = slots[head];
+      {
+         std::unique_lock<std::mutex> lock(mutex);
+         decoded.wait(lock, [&slot] { return slot.ready; });
+      }
+
+      if (currentPos < slot.decoded.size) {
+         const size_t count = std::min(block.capacity(), 
+                                       slot.decoded.size - currentPos);
+         std::copy_n(&slot.decoded.addrs[currentPos], count, block.addrs.begin());
+         std::copy_n(&slot.decoded.types[currentPos], count, block.types.begin());
+         std::copy_n(&slot.decoded.tids[currentPos], count, block.tids.begin());
+         block.size = count;
+         currentPos += count;
+         return true;
+      }
+
+      // The slot becomes the last of the blocks in flight
+      if (!readBlock(slot)) {
+         --inFlight;
+      }
+      head = (head + 1) % slots.size();
+      currentPos = 0;
+   }
+
+   block.size = 0;
+   return false;
+}
+
+std::unique_ptr<TraceReader> openTrace(const std::string& path, 
+                                       TraceFormat format, std::string& error)
+{
+   int fd = tryOpenInput(path);
+   if (fd < 0) {
+      error = "cannot open " + path + ": " + strerror(errno);
+      return nullptr;
+   }
+
+   // The input may be a pipe, so the start of the file is read once and
+   // passed to the reader
+   TraceHeader header;
+   size_t size = readFully(fd, &header, sizeof(header));
+   bool binary = size == sizeof(header) && 
+                 std::memcmp(header.magic, traceMagic, sizeof(traceMagic)) == 0;
+   std::string mismatch;
+   if (binary && format == TraceFormat::Text) {
+      mismatch = " is a binary trace, not text";
+   } else if (!binary && format == TraceFormat::Binary) {
+      mismatch = " is not a binary trace";
+   } else if (binary && (header.version != traceVersion || 
+                         header.recordSize != traceRecordSize(header.flags))) {
+      mismatch = " is a binary trace of an unsupported version";
+   }
+   if (!mismatch.empty()) {
+      error = path + mismatch;
+      close(fd);
+      return nullptr;
+   }
+
+   if (!binary) {
+      return std::make_unique<PinatraceParser>(fd, (const char*) &header, size);
+   } else if (header.flags & TraceCompressed) {
+      return std::make_unique<CompressedTraceReader>(fd, &header);
+   }
+
+   struct stat st;
+   if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+      return std::make_unique<MappedTraceReader>(fd);
+   } else {
+      return std::make_unique<BinaryTraceReader>(fd, header);
+   }
+}
+
+bool isBinaryTrace(const std::string& path)
+{
+   std::ifstream in(path, std::ifstream::binary);
+   char magic[sizeof(traceMagic)];
+
+   in.read(magic, sizeof(magic));
+   return in.gcount() == sizeof(magic) && 
+          std::memcmp(magic, traceMagic, sizeof(magic)) == 0;
+}
+
+void checkTraceHeader(const TraceHeader& header)
+{
+   assert(std::memcmp(header.magic, traceMagic, sizeof(traceMagic)) == 0);
+   assert(header.version == traceVersion);
+   assert(header.recordSize == traceRecordSize(header.flags));
+   (void) header;
+}
@@ -0,0 +1,358 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "misc.h"
+
+// Binary trace format. A trace is a TraceHeader followed by
+// fixed-size records, all little-endian:
+//    uint64_t address
+//    uint32_t info       bit 0 set for writes, TID in bits 1-31
+//    uint64_t pc         only if TraceHasPC is set
+// Traces converted from pinatrace output have no TIDs, in which case
+// TraceHasTid is clear and every record's TID is 0.
+//
+// If TraceCompressed is set the header is instead followed by blocks
+// of records, each a TraceBlockHeader and its payload. The records of
+// a block are encoded as given by the header's encoding (recordSize
+// still gives the size of an unencoded record), then compressed with
+// lzCompress (see lz.h) unless that would not make them smaller.
+// Blocks can be decoded independently of each other
+
+constexpr char traceMagic[8] = {'M', 'C', 'S', 'T', 'R', 'A', 'C', 'E'};
+constexpr uint32_t traceVersion = 1;
+// TraceHeader::records of a trace whose writer has not finished, or
+// could not seek back to the header
+constexpr uint64_t traceUnknownRecords = ~((uint64_t) 0);
+
+enum TraceFlags : uint32_t {
+   TraceHasTid = 1 << 0,
+   TraceHasPC = 1 << 1,
+   TraceCompressed = 1 << 2,
+};
+
+struct TraceHeader {
+   char magic[8];
+   uint32_t version;
+   uint32_t flags;
+   uint32_t recordSize; // Bytes per record, depends on flags
+   uint32_t reserved;
+   uint64_t records; // Number of records following the header
+};
+
+static_assert(sizeof(TraceHeader) == 32, "TraceHeader must be packed");
+
+struct __attribute__((packed)) TraceRecord {
+   uint64_t address;
+   uint32_t info;
+
+   AccessType type() const 
+   { return (info & 1) ? AccessType::Write : AccessType::Read; }
+   unsigned int tid() const { return info >> 1; }
+};
+
+// Largest TID a record can hold in the 31 bits of info
+constexpr unsigned int traceMaxTid = 0x7fffffff;
+
+inline uint32_t traceRecordInfo(AccessType type, unsigned int tid)
+{
+   return (tid << 1) | (type == AccessType::Write ? 1 : 0);
+}
+
+inline uint32_t traceRecordSize(uint32_t flags)
+{
+   return sizeof(TraceRecord) + ((flags & TraceHasPC) ? sizeof(uint64_t) : 0);
+}
+
+// Encodings of the records in a block of a compressed trace
+enum TraceEncoding : uint32_t {
+   // Each record's address minus the previous one's (or 0 for the
+   // first), then its info, then its PC minus the previous PC if
+   // TraceHasPC is set. Each field is stored as byte planes: byte 0 of
+   // every record's value, then byte 1 of every record's, and so on
+   TraceDeltaPlanar = 0,
+   // Each record is a tag byte, with the write bit in bit 0 and the
+   // TID in bits 1-7 (127 if the TID follows as a varint), then the
+   // address minus the previous address of the same TID, and then the
+   // PC minus the same TID's previous PC if TraceHasPC is set. The
+   // differences are zigzag encoded (so small negative ones are small)
+   // and stored as LEB128 varints. Addresses and PCs start at 0 for
+   // each TID in each block
+   TraceVarint = 1,
+};
+
+struct TraceBlockHeader {
+   uint32_t records;
+   uint32_t encoding;
+   uint32_t rawSize; // Bytes of encoded records
+   uint32_t compressedSize; // Bytes of payload, rawSize if stored uncompressed
+};
+
+static_assert(sizeof(TraceBlockHeader) == 16, "TraceBlockHeader must be packed");
+
+// Records per block written in compressed traces
+constexpr size_t traceBlockRecords = 65536;
+
+// A block of decoded accesses, laid out as taken by
+// System::memAccessBatch
+struct TraceBlock {
+   std::vector<uint64_t> addrs;
+   std::vector<AccessType> types;
+   std::vector<unsigned int> tids;
+   size_t size{0};
+
+   explicit TraceBlock(size_t capacity = 4096) : 
+         addrs(capacity), types(capacity), tids(capacity) {}
+   size_t capacity() const { return addrs.size(); }
+};
+
+// Interface of the trace readers below, for drivers that take traces
+// in any format
+class TraceReader {
+public:
+   virtual ~TraceReader() = default;
+   // Fills block with up to its capacity of records. Returns false
+   // once there are no records left
+   virtual bool next(TraceBlock& block) = 0;
+   // Whether the trace records TIDs, otherwise they are all 0
+   virtual bool hasTids() const = 0;
+};
+
+// Writes a binary trace. The record count in the header is filled in
+// when the writer is destroyed. Traces with TraceCompressed set are
+// written in blocks of block_records records with the given encoding.
+// TIDs must be at most traceMaxTid
+class TraceWriter {
+public:
+   TraceWriter(const std::string& path, uint32_t flags, 
+               size_t block_records = traceBlockRecords,
+               TraceEncoding encoding = TraceVarint);
+   ~TraceWriter();
+   void write(uint64_t address, AccessType type, unsigned int tid, 
+              uint64_t pc = 0);
+private:
+   std::ofstream out;
+   std::vector<char> buffer;
+   size_t used{0};
+   uint32_t flags;
+   TraceEncoding encoding;
+   uint64_t records{0};
+   // Used for compressing blocks
+   std::vector<uint8_t> encoded;
+   std::vector<uint8_t> compressed;
+
+   void flush();
+};
+
+// The readers below take "-" as the path of stdin, and also read from
+// named pipes, so a trace can be simulated as it is produced. The ones
+// taking a file descriptor take ownership of it.
+
+// Reads a binary trace a block at a time with read()
+class BinaryTraceReader final : public TraceReader {
+public:
+   explicit BinaryTraceReader(const std::string& path);
+   // Reads the records following header, which was read from fd
+   BinaryTraceReader(int fd, const TraceHeader& header);
+   ~BinaryTraceReader();
+   BinaryTraceReader(const BinaryTraceReader&) = delete;
+   BinaryTraceReader& operator=(const BinaryTraceReader&) = delete;
+
+   const TraceHeader& getHeader() const { return header; }
+   bool next(TraceBlock& block) override;
+   bool hasTids() const override { return header.flags & TraceHasTid; }
+private:
+   int fd;
+   TraceHeader header;
+   std::vector<char> buffer;
+   uint64_t remaining;
+};
+
+// A run of records inside a MappedTraceReader's mapping
+struct TraceSpan {
+   const char* data{nullptr};
+   size_t size{0};
+   uint32_t recordSize{0};
+
+   TraceRecord operator[](size_t i) const
+   {
+      TraceRecord record;
+      std::memcpy(&record, data + i * recordSize, sizeof(record));
+      return record;
+   }
+};
+
+// Reads a binary trace by mapping the whole file, so records are
+// handed out as spans of the mapping without being copied. The kernel
+// is told the file is read sequentially, and is asked to read ahead of
+// and drop pages behind the current span. Only regular files can be
+// mapped
+class MappedTraceReader final : public TraceReader {
+public:
+   explicit MappedTraceReader(const std::string& path);
+   explicit MappedTraceReader(int fd);
+   ~MappedTraceReader();
+   MappedTraceReader(const MappedTraceReader&) = delete;
+   MappedTraceReader& operator=(const MappedTraceReader&) = delete;
+
+   const TraceHeader& getHeader() const { return header; }
+   // Sets span to the next max_records records or fewer. Returns false
+   // once there are no records left
+   bool next(TraceSpan& span, size_t max_records = 65536);
+   // Decodes the next records into block
+   bool next(TraceBlock& block) override;
+   bool hasTids() const override { return header.flags & TraceHasTid; }
+private:
+   // Bytes requested ahead of the current span
+   static constexpr size_t readAhead = 64 << 20;
+
+   int fd;
+   const char* map;
+   size_t mapSize;
+   TraceHeader header;
+   // Offset of the next record, and of the end of the read-ahead window
+   size_t offset;
+   size_t adviseEnd;
+   // Pages before this offset have been released
+   size_t releasedEnd{0};
+};
+
+// Parses the text output of the ManualExamples/pinatrace pin tool,
+// lines of the form "<pc>: <R|W> <address>". The file is read in
+// large blocks and each line is decoded in place, without iostreams.
+// Lines starting with '#' are ignored, and records get TID 0
+class PinatraceParser final : public TraceReader {
+public:
+   explicit PinatraceParser(const std::string& path);
+   // Parses size bytes of data, already read from fd, and then the rest
+   // of fd
+   PinatraceParser(int fd, const char* data, size_t size);
+   ~PinatraceParser();
+   PinatraceParser(const PinatraceParser&) = delete;
+   PinatraceParser& operator=(const PinatraceParser&) = delete;
+
+   // Fills block with the next records, and pcs with their PCs if it is
+   // not null (it must hold block.capacity() values). Returns false
+   // once there are no records left
+   bool next(TraceBlock& block, uint64_t* pcs);
+   bool next(TraceBlock& block) override { return next(block, nullptr); }
+   bool hasTids() const override { return false; }
+   // Number of lines that could not be parsed or had a null address
+   uint64_t getSkipped() const { return skipped; }
+private:
+   static constexpr size_t bufferSize = 4 << 20;
+   // Bytes readable past the data, so a number can be scanned 16
+   // characters at a time wherever it starts
+   static constexpr size_t padding = 32;
+
+   int fd;
+   std::vector<char> buffer;
+   size_t pos{0}; // Start of the next line
+   size_t end{0}; // End of the last complete line in the buffer
+   size_t filled{0};
+   bool eof{false};
+   uint64_t skipped{0};
+
+   // Moves the incomplete line at the end of the buffer to the front
+   // and reads more. Returns false if there are no lines left
+   bool refill();
+};
+
+// Reads a trace with TraceCompressed set. Blocks are read ahead and
+// decompressed on up to threads threads at once, one per CPU if 0
+class CompressedTraceReader final : public TraceReader {
+public:
+   explicit CompressedTraceReader(const std::string& path, 
+                                  unsigned int threads = 0);
+   // header is read from fd if it is null
+   CompressedTraceReader(int fd, const TraceHeader* header, 
+                         unsigned int threads = 0);
+   ~CompressedTraceReader();
+   CompressedTraceReader(const CompressedTraceReader&) = delete;
+   CompressedTraceReader& operator=(const CompressedTraceReader&) = delete;
+
+   const TraceHeader& getHeader() const { return header; }
+   bool next(TraceBlock& block) override;
+   bool hasTids() const override { return header.flags & TraceHasTid; }
+private:
+   // A block read from the file and decoded by one of the threads. The
+   // buffers are reused for later blocks
+   struct Slot {
+      TraceBlockHeader header;
+      std::vector<uint8_t> payload;
+      std::vector<uint8_t> raw; // Decompressed payload
+      TraceBlock decoded{0};
+      bool ready{false}; // Set once decoded
+   };
+
+   int fd;
+   TraceHeader header;
+   bool eof{false};
+   // Blocks in trace order, starting with the one being handed out by
+   // next. inFlight of them have been read
+   std::vector<Slot> slots;
+   size_t head{0};
+   size_t inFlight{0};
+   size_t currentPos{0}; // Position in the head block
+
+   std::mutex mutex;
+   std::condition_variable queued;
+   std::condition_variable decoded;
+   std::deque<Slot*> queue; // Blocks waiting to be decoded
+   bool stopping{false};
+   std::vector<std::thread> threads;
+
+   // Reads the next block into slot and queues it for decoding.
+   // Returns false at the end of the trace
+   bool readBlock(Slot& slot);
+   void decodeLoop();
+};
+
+enum class TraceFormat {
+   Auto, // Binary if the file starts with a binary trace header
+   Text, // pinatrace output
+   Binary, // Binary, compressed or not
+};
+
+// Opens a trace in any of the formats above, mapping it if possible.
+// Returns null and sets error if the file can't be opened or is not
+// in the given format
+std::unique_ptr<TraceReader> openTrace(const std::string& path, 
+                                       TraceFormat format, std::string& error);
+
+// Returns true if the file at path starts with a binary trace header
+bool isBinaryTrace(const std::string& path);
+// Checks the header read from a binary trace
+void checkTraceHeader(const TraceHeader& header);
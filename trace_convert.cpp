@@ -0,0 +1,96 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include "trace.h"
+
+using namespace std;
+
+void usage() {
+   cout << "Usage: ./trace_convert [-z] <pinatrace file> <binary trace file>"
+        << " [keep PCs 'y'|'n']" << endl
+        << "   -z  write a compressed trace" << endl;
+}
+
+// Converts the text output of the ManualExamples/pinatrace pin tool,
+// lines of the form "<pc>: <R|W> <address>", to a binary trace
+int main(int argc, char* argv[]) {
+   uint32_t flags = 0;
+   int opt;
+   while ((opt = getopt(argc, argv, "z")) != -1) {
+      if (opt == 'z') {
+         flags |= TraceCompressed;
+      } else {
+         usage();
+         return -1;
+      }
+   }
+
+   argc -= optind - 1;
+   argv += optind - 1;
+   if (argc != 3 && argc != 4) {
+      usage();
+      return -1;
+   }
+
+   if (argc == 4) {
+      string pc_choice(argv[3]);
+      if (pc_choice == "y") {
+         flags |= TraceHasPC;
+      } else if (pc_choice != "n") {
+         usage();
+         return -1;
+      }
+   }
+
+   if (string(argv[1]) != "-" && access(argv[1], R_OK) != 0) {
+      cerr << "Cannot open " << argv[1] << endl;
+      return -1;
+   }
+
+   PinatraceParser parser(argv[1]);
+   TraceBlock block;
+   vector<uint64_t> pcs(block.capacity());
+   uint64_t records = 0;
+   {
+      TraceWriter writer(argv[2], flags);
+
+      while (parser.next(block, pcs.data())) {
+         for (size_t i = 0; i < block.size; ++i) {
+            writer.write(block.addrs[i], block.types[i], 0, pcs[i]);
+         }
+         records += block.size;
+      }
+   }
+
+   // Keep the summary out of a trace written to stdout
+   ostream& info = string(argv[2]) == "-" ? cerr : cout;
+   info << "Records: " << records << endl;
+   info << "Skipped lines: " << parser.getSkipped() << endl;
+
+   return 0;
+}
@@ -0,0 +1,139 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#include <immintrin.h>
+
+#include "waymatch.h"
+
+using WayMatchFn = int (*)(const uint64_t* tags, unsigned int n, uint64_t tag);
+
+static int matchWayScalar(const uint64_t* tags, unsigned int n, uint64_t tag)
+{
+   for (unsigned int i = 0; i < n; ++i) {
+      if (tags[i] == tag) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+// SSE2 has no 64-bit compare, so compare 32-bit halves and require
+// both halves of a lane to match
+__attribute__((target("sse2")))
+static int matchWaySSE2(const uint64_t* tags, unsigned int n, uint64_t tag)
+{
+   const __m128i key = _mm_set1_epi64x(tag);
+   unsigned int i = 0;
+
+   for (; i + 2 <= n; i += 2) {
+      __m128i cmp = _mm_cmpeq_epi32(
+            _mm_loadu_si128((const __m128i*) (tags + i)), key);
+      cmp = _mm_and_si128(cmp, _mm_shuffle_epi32(cmp, _MM_SHUFFLE(2, 3, 0, 1)));
+      int mask = _mm_movemask_pd(_mm_castsi128_pd(cmp));
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+
+   for (; i < n; ++i) {
+      if (tags[i] == tag) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+__attribute__((target("avx2")))
+static int matchWayAVX2(const uint64_t* tags, unsigned int n, uint64_t tag)
+{
+   const __m256i key = _mm256_set1_epi64x(tag);
+   unsigned int i = 0;
+
+   for (; i + 4 <= n; i += 4) {
+      __m256i cmp = _mm256_cmpeq_epi64(
+            _mm256_loadu_si256((const __m256i*) (tags + i)), key);
+      int mask = _mm256_movemask_pd(_mm256_castsi256_pd(cmp));
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+
+   for (; i < n; ++i) {
+      if (tags[i] == tag) {
+         return i;
+      }
+   }
+
+   return -1;
+}
+
+__attribute__((target("avx512f")))
+static int matchWayAVX512(const uint64_t* tags, unsigned int n, uint64_t tag)
+{
+   const __m512i key = _mm512_set1_epi64(tag);
+   unsigned int i = 0;
+
+   for (; i + 8 <= n; i += 8) {
+      __mmask8 mask = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(tags + i), key);
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+
+   // Masked load for the remaining ways, masked-off lanes never match
+   if (i < n) {
+      __mmask8 valid = (1u << (n - i)) - 1;
+      __mmask8 mask = _mm512_mask_cmpeq_epi64_mask(valid,
+            _mm512_maskz_loadu_epi64(valid, tags + i), key);
+      if (mask) {
+         return i + __builtin_ctz(mask);
+      }
+   }
+
+   return -1;
+}
+
+static WayMatchFn selectWayMatch()
+{
+   __builtin_cpu_init();
+
+   if (__builtin_cpu_supports("avx512f")) {
+      return matchWayAVX512;
+   } else if (__builtin_cpu_supports("avx2")) {
+      return matchWayAVX2;
+   } else if (__builtin_cpu_supports("sse2")) {
+      return matchWaySSE2;
+   }
+
+   return matchWayScalar;
+}
+
+// Chosen on the first call rather than at static initialization, so
+// caches built by other static initializers can search too
+int matchWay(const uint64_t* tags, unsigned int n, uint64_t tag)
+{
+   static const WayMatchFn kernel = selectWayMatch();
+   return kernel(tags, n, tag);
+}
@@ -0,0 +1,74 @@
+/*
+Copyright (c) 2015-2018 Justin Funston
+
+This software is provided 'as-is', without any express or implied
+warranty. In no event will the authors be held liable for any damages
+arising from the use of this software.
+
+Permission is granted to anyone to use this software for any purpose,
+including commercial applications, and to alter it and redistribute it
+freely, subject to the following restrictions:
+
+   1. The origin of this software must not be misrepresented; you must not
+   claim that you wrote the original software. If you use this software
+   in a product, an acknowledgment in the product documentation would be
+   appreciated but is not required.
+
+   2. Altered source versions must be plainly marked as such, and must not be
+   misrepresented as being the original software.
+
+   3. This notice may not be removed or altered from any source
+   distribution.
+*/
+
+#pragma once
+
+#include <cstdint>
+#include <immintrin.h>
+
+// Searches the ways of a single set for a tag. Returns the position of
+// the first element of tags[0..n) equal to tag, or -1 if there is none.
+// Uses the widest kernel the host supports (AVX-512, AVX2, SSE2 or
+// scalar), chosen on the first call
+int matchWay(const uint64_t* tags, unsigned int n, uint64_t tag);
+
+// For an associativity known at compile time, so the loop can be fully
+// unrolled. Uses the vector width of the build's target (the Makefile
+// builds with -march=native) rather than dispatching at runtime
+template <unsigned int Ways>
+inline int matchWayUnrolled(const uint64_t* tags, uint64_t tag)
+{
+#if defined(__AVX512F__)
+   if (Ways % 8 == 0) {
+      const __m512i key = _mm512_set1_epi64(tag);
+      for (unsigned int i = 0; i < Ways; i += 8) {
+         __mmask8 mask = _mm512_cmpeq_epi64_mask(_mm512_loadu_si512(tags + i), key);
+         if (mask) {
+            return i + __builtin_ctz(mask);
+         }
+      }
+      return -1;
+   }
+#elif defined(__AVX2__)
+   if (Ways % 4 == 0) {
+      const __m256i key = _mm256_set1_epi64x(tag);
+      for (unsigned int i = 0; i < Ways; i += 4) {
+         __m256i cmp = _mm256_cmpeq_epi64(
+               _mm256_loadu_si256((const __m256i*) (tags + i)), key);
+         int mask = _mm256_movemask_pd(_mm256_castsi256_pd(cmp));
+         if (mask) {
+            return i + __builtin_ctz(mask);
+         }
+      }
+      return -1;
+   }
+#endif
+
+   for (unsigned int i = 0; i < Ways; ++i) {
+      if (tags[i] == tag) {
+         return i;
+      }
+   }
+
+   return -1;
+}